@@ -1,15 +1,37 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 extern "C" {
 #include "sim.h"
 }
 
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
-#include "llvm/ExecutionEngine/GenericValue.h"
-#include "llvm/ExecutionEngine/MCJIT.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/LLVMContext.h"
@@ -23,42 +45,289 @@ using namespace llvm;
 static FunctionCallee ext(Module& M, const char* n, Type* r, ArrayRef<Type*> a) {
   return M.getOrInsertFunction(n, FunctionType::get(r, a, false));
 }
-static Value* gep2D(IRBuilder<>& B, LLVMContext& C, Value* base,
+static Value* gep2D(IRBuilder<>& B, LLVMContext& C, Type* cellTy, Value* base,
                     unsigned H, unsigned W, Value* y, Value* x) {
   Value* idx[3] = { ConstantInt::get(Type::getInt32Ty(C),0), y, x };
-  return B.CreateInBoundsGEP(ArrayType::get(ArrayType::get(Type::getInt32Ty(C),W),H), base, idx);
+  return B.CreateInBoundsGEP(ArrayType::get(ArrayType::get(cellTy,W),H), base, idx);
 }
 
-int main() {
-  constexpr int CELL = 3;
-  constexpr int W = SIM_X_SIZE / CELL;
-  constexpr int H = SIM_Y_SIZE / CELL;
-  constexpr int STEPS_PER_FRAME = 4;
-  constexpr int SOURCES = 4;
-  constexpr int COOLING = 1;
+// Снимок SDL/app3.c (--heat-snapshot) -> глобалы модуля: при --heat-restore=path
+// init последним вызывает appRestore(cur, sx, sy, svx, svy, sr, st)
+static struct { const char* path; int w, h, sources, elem; } Restore;
+
+// Наибольший радиус источника: таблица diskSpan строится до него (init даёт 4..12)
+static constexpr int RMAX = 12;
+
+static void appRestore(void* u0, int* sx, int* sy, int* svx, int* svy, int* sr, int* st) {
+  SimSnapshot s;
+  simSnapshotLoad(Restore.path, &s);
+  if (s.w != Restore.w || s.h != Restore.h || s.sources != Restore.sources) {
+    fprintf(stderr, "app_ir: snapshot %s is %dx%d with %d sources, module is %dx%d with %d\n",
+            Restore.path, s.w, s.h, s.sources, Restore.w, Restore.h, Restore.sources);
+    exit(1);
+  }
+  // радиус индексирует diskSpan без проверок в IR - чужой снимок проверяется здесь
+  for (int i = 0; i < s.sources; ++i)
+    if (s.src[4][i] < 0 || s.src[4][i] > RMAX) {
+      fprintf(stderr, "app_ir: snapshot %s: source %d has radius %d (0..%d supported)\n",
+              Restore.path, i, s.src[4][i], RMAX);
+      exit(1);
+    }
+  // в снимке строки дополнены до stride, в модуле лежат плотно; значения 0..255
+  for (int y = 0; y < s.h; ++y)
+    for (int x = 0; x < s.w; ++x) {
+      size_t from = (size_t)y * s.stride + x, to = (size_t)y * s.w + x;
+      int t = s.elem == 1 ? ((unsigned char*)s.field)[from] : ((int*)s.field)[from];
+      if (Restore.elem == 1) ((unsigned char*)u0)[to] = (unsigned char)t;
+      else ((int*)u0)[to] = t;
+    }
+  int* dst[6] = { sx, sy, svx, svy, sr, st };
+  for (int k = 0; k < 6; ++k)
+    memcpy(dst[k], s.src[k], (size_t)s.sources * sizeof(int));
+  fprintf(stderr, "app_ir: restored frame %lld from %s\n", s.frame, Restore.path);
+}
+
+// Время компиляции по уровням (--jit-opt): оптимизация IR и кодогенерация
+// идут в потоках компиляции, итог печатается при выходе рядом с телеметрией sim.c.
+// Готовые объекты кладутся в кэш на диске (--jit-cache), и повторный запуск
+// платит только за построение IR
+static struct {
+  int level;
+  long long buildNs;              // построение и проверка IR в main
+  std::atomic<long long> optNs{0}, codegenNs{0}, cacheNs{0};
+  std::atomic<int> functions{0}, hits{0}, misses{0};
+  const char* dump;               // --jit-dump=ir|asm: в stderr после оптимизации
+  std::mutex dumpLock;
+  std::string cacheDir;           // пусто - без кэша
+} Jit;
+
+static long long nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void jitReport() {
+  fprintf(stderr, "jit: O%d, %d functions, build IR %.1f ms, optimize %.1f ms, codegen %.1f ms\n",
+          Jit.level, Jit.functions.load(), Jit.buildNs / 1e6, Jit.optNs.load() / 1e6,
+          Jit.codegenNs.load() / 1e6);
+  if (!Jit.cacheDir.empty())
+    fprintf(stderr, "jit: cache %s: %d hits, %d misses, load/store %.1f ms\n", Jit.cacheDir.c_str(),
+            Jit.hits.load(), Jit.misses.load(), Jit.cacheNs.load() / 1e6);
+}
+
+// PassBuilder: стандартный конвейер O0..O3 с векторизаторами циклов и SLP
+// (кроме O0); анализ стоимости - от TargetMachine хоста
+static void optimizeModule(Module& M, TargetMachine& TM, int level) {
+  static const OptimizationLevel Levels[] = { OptimizationLevel::O0, OptimizationLevel::O1,
+                                              OptimizationLevel::O2, OptimizationLevel::O3 };
+  PipelineTuningOptions PTO;
+  PTO.LoopVectorization = level > 0;
+  PTO.SLPVectorization = level > 0;
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(&TM, PTO);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  ModulePassManager MPM = level == 0 ? PB.buildO0DefaultPipeline(Levels[0])
+                                     : PB.buildPerModuleDefaultPipeline(Levels[level]);
+  MPM.run(M, MAM);
+}
+
+static void dumpModule(Module& M, TargetMachine& TM) {
+  std::lock_guard<std::mutex> lock(Jit.dumpLock);
+  if (strcmp(Jit.dump, "ir") == 0) {
+    M.print(errs(), nullptr);
+    return;
+  }
+  // кодогенерация меняет модуль - ассемблер печатается с копии
+  auto copy = CloneModule(M);
+  legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, errs(), nullptr,
+#if LLVM_VERSION_MAJOR >= 18
+                             CodeGenFileType::AssemblyFile
+#else
+                             CGFT_AssemblyFile
+#endif
+                             )) {
+    errs() << "jit: no assembly printer for the target\n";
+    return;
+  }
+  PM.run(*copy);
+}
+
+// Компилятор ORC для каждой лениво выделенной функции, в её потоке компиляции:
+// кэш -> оптимизация -> кодогенерация -> запись в кэш. Ключ - SHA1 биткода до
+// оптимизации, триплета, CPU с признаками и уровня, так что смена машины или
+// --jit-opt даёт другой файл
+class CachingCompiler : public orc::IRCompileLayer::IRCompiler {
+public:
+  explicit CachingCompiler(orc::JITTargetMachineBuilder JTMB)
+    : IRCompiler(orc::irManglingOptionsFromTargetOptions(JTMB.getOptions())), TMB(JTMB),
+      Inner(std::move(JTMB)) {}
+
+  Expected<std::unique_ptr<MemoryBuffer>> operator()(Module& M) override {
+    for (auto& F : M)
+      Jit.functions += !F.isDeclaration();
+    // при --jit-dump модуль всегда оптимизируется заново, иначе печатать нечего
+    std::string path = Jit.cacheDir.empty() || Jit.dump ? std::string() : cachePath(M);
+    if (!path.empty()) {
+      long long t0 = nowNs();
+      auto hit = MemoryBuffer::getFile(path);
+      Jit.cacheNs += nowNs() - t0;
+      if (hit) {
+        ++Jit.hits;
+        return std::move(*hit);
+      }
+      ++Jit.misses;
+    }
+
+    auto TM = TMB.createTargetMachine();
+    if (!TM) return TM.takeError();
+    long long t0 = nowNs();
+    optimizeModule(M, **TM, Jit.level);
+    Jit.optNs += nowNs() - t0;
+    if (Jit.dump) dumpModule(M, **TM);
+
+    t0 = nowNs();
+    auto obj = Inner(M);
+    Jit.codegenNs += nowNs() - t0;
+    if (obj && !path.empty()) {
+      t0 = nowNs();
+      store(path, **obj);
+      Jit.cacheNs += nowNs() - t0;
+    }
+    return obj;
+  }
+
+private:
+  std::string cachePath(Module& M) {
+    SmallVector<char, 0> bc;
+    raw_svector_ostream os(bc);
+    WriteBitcodeToFile(M, os);
+    SHA1 h;
+    h.update(StringRef(bc.data(), bc.size()));
+    h.update(TMB.getTargetTriple().str());
+    h.update(TMB.getCPU());
+    h.update(TMB.getFeatures().getString());
+    h.update(std::to_string(Jit.level) + " " LLVM_VERSION_STRING);
+    SmallString<256> path(Jit.cacheDir);
+    sys::path::append(path, toHex(h.final(), true) + ".o");
+    return std::string(path);
+  }
+
+  // Атомарно: уникальный временный файл рядом и rename, так что параллельные
+  // запуски не видят недописанный объект
+  static void store(const std::string& path, const MemoryBuffer& obj) {
+    int fd;
+    SmallString<256> tmp;
+    if (sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, tmp)) return;
+    {
+      raw_fd_ostream os(fd, true);
+      os << obj.getBuffer();
+      if (os.has_error()) { os.clear_error(); sys::fs::remove(tmp); return; }
+    }
+    if (sys::fs::rename(tmp, path)) sys::fs::remove(tmp);
+  }
+
+  orc::JITTargetMachineBuilder TMB;
+  orc::ConcurrentIRCompiler Inner;
+};
+
+// Ширина векторных регистров хоста в битах - для N в simd-варианте диффузии
+static unsigned hostVectorBits() {
+  StringMap<bool> f;
+  if (!sys::getHostCPUFeatures(f)) return 128;
+  return f.lookup("avx512f") ? 512 : f.lookup("avx2") ? 256 : 128;
+}
+
+int main(int argc, char** argv) {
+  const long long mainStart = nowNs();
+  simArgs(argc, argv);
+
+  // Параметры - при запуске, как в SDL/app3.c (--heat-w=N или HEAT_W=N и т.д.),
+  // и попадают в IR константами: LLVM видит точные границы циклов и шаги адресов.
+  // При --heat-restore размеры сетки и число источников по умолчанию - из снимка
+  SimSnapshot snap = {};
+  const char* restore = simOption("heat-restore");
+  if (restore && *restore) simSnapshotLoad(restore, &snap);
+  const int CELL = (int)simOptionInt("heat-cell", 3);
+  const int W = (int)simOptionInt("heat-w", snap.field ? snap.w : SIM_X_SIZE / CELL);
+  const int H = (int)simOptionInt("heat-h", snap.field ? snap.h : SIM_Y_SIZE / CELL);
+  const int STEPS_PER_FRAME = (int)simOptionInt("heat-steps", 4);
+  const int SOURCES = (int)simOptionInt("heat-sources", snap.field ? snap.sources : 4);
+  const int COOLING = (int)simOptionInt("heat-cooling", 1);
+  if (CELL < 1 || W < 3 || H < 3 || STEPS_PER_FRAME < 1 || SOURCES < 0 || COOLING < 0) {
+    fprintf(stderr, "app_ir: bad grid %dx%d (cell %d, steps %d, sources %d, cooling %d)\n",
+            W, H, CELL, STEPS_PER_FRAME, SOURCES, COOLING);
+    return 1;
+  }
+
+  // Хранение клеток: HEAT_STORAGE=u8 (--heat-storage=u8) - i8 вместо i32.
+  // Температура всегда в 0..255, так что результат тот же, а поля вчетверо меньше
+  const char* storage = simOption("heat-storage");
+  const bool narrow = storage && strcmp(storage, "u8") == 0;
+  Restore = { restore, W, H, SOURCES, narrow ? 1 : 4 };
 
   InitializeNativeTarget();
   InitializeNativeTargetAsmPrinter();
   InitializeNativeTargetAsmParser();
 
-  LLVMContext C;
+  auto Ctx = std::make_unique<LLVMContext>();
+  LLVMContext& C = *Ctx;
   auto M = std::make_unique<Module>("app3_ir", C);
   IRBuilder<> B(C);
 
   Type* i32 = Type::getInt32Ty(C);
   Type* voidTy = Type::getVoidTy(C);
 
-  auto fPut   = ext(*M, "simPutPixel", voidTy, {i32,i32,i32});
   auto fFlush = ext(*M, "simFlush",    voidTy, {});
   auto fRand  = ext(*M, "simRand",     i32,    {});
+  auto* i32p  = PointerType::getUnqual(i32);
+  Type* cellTy = narrow ? Type::getInt8Ty(C) : i32;
+  auto fCells = ext(*M, "simAddCells", voidTy, {Type::getInt64Ty(C)});
+  auto fFrame = ext(*M, "simFramebuffer", i32p, {});
+  auto fDirty = ext(*M, "simMarkDirty", voidTy, {i32,i32,i32,i32});
+  // Фазы кадра - функциями строк (i32 y0, i32 y1), их раздаёт пулу simParallelFor
+  auto* rowsTy = FunctionType::get(voidTy, {i32, i32}, false);
+  auto fParFor = ext(*M, "simParallelFor", voidTy, {PointerType::getUnqual(rowsTy), i32, i32, i32});
 
   // Буферы и массивы источников
-  auto arrW  = ArrayType::get(i32, W);
+  auto arrW  = ArrayType::get(cellTy, W);
   auto arrHW = ArrayType::get(arrW, H);
   auto* U0 = new GlobalVariable(*M, arrHW, false, GlobalValue::InternalLinkage,
                                 ConstantAggregateZero::get(arrHW), "U0");
   auto* U1 = new GlobalVariable(*M, arrHW, false, GlobalValue::InternalLinkage,
                                 ConstantAggregateZero::get(arrHW), "U1");
+  // Двойной буфер без копирования, как ping в SDL/app3.c: @cur - текущее поле
+  // (подогрев, рендер), @next - куда пишет диффузия; после шага они меняются местами
+  auto* fieldp = PointerType::getUnqual(arrHW);
+  auto* Cur = new GlobalVariable(*M, fieldp, false, GlobalValue::InternalLinkage, U0, "cur");
+  auto* Nxt = new GlobalVariable(*M, fieldp, false, GlobalValue::InternalLinkage, U1, "next");
+
+  // Палитра: температура 0..255 -> (r, g=r/2, b=255-r)
+  std::vector<Constant*> palVals;
+  for (int T = 0; T < 256; ++T)
+    palVals.push_back(ConstantInt::get(i32, (0xFFu << 24) | (T << 16) | ((T >> 1) << 8) | (255 - T)));
+  auto* palTy = ArrayType::get(i32, 256);
+  auto* pal = new GlobalVariable(*M, palTy, true, GlobalValue::InternalLinkage,
+                                 ConstantArray::get(palTy, palVals), "palette");
+
+  // Полуширины дисков: diskSpan[r*(r+1)/2 + |dy|] = max dx, dx*dx + dy*dy <= r*r
+  // (радиусы источников 4..12, см. инициализацию)
+  std::vector<Constant*> spanVals;
+  for (int r = 0; r <= RMAX; ++r)
+    for (int dy = 0, dx = r; dy <= r; ++dy) {
+      while (dx * dx + dy * dy > r * r) --dx;
+      spanVals.push_back(ConstantInt::get(i32, dx));
+    }
+  auto* spanTy = ArrayType::get(i32, spanVals.size());
+  auto* diskSpan = new GlobalVariable(*M, spanTy, true, GlobalValue::InternalLinkage,
+                                      ConstantArray::get(spanTy, spanVals), "diskSpan");
 
   auto* A_i32_S = ArrayType::get(i32, SOURCES);
   auto* sx  = new GlobalVariable(*M, A_i32_S, false, GlobalValue::InternalLinkage,
@@ -74,10 +343,52 @@ int main() {
   auto* st  = new GlobalVariable(*M, A_i32_S, false, GlobalValue::InternalLinkage,
                                  ConstantAggregateZero::get(A_i32_S), "st");
 
-  // define void @app()
+  // void @init() - источники, void @step.<v>(i32 n) - n раз @heat (диски) и
+  // @diffuse.<v> (DIFF с краями, смена буферов), void @render() - вывод @cur;
+  // void @app(step) вызывает их покадрово с выбранным вариантом шага, режим
+  // --heat-bench - напрямую. heat, diffuse и render сами только раздают строки
+  // функциям @heat.rows, @diffuse.<v>.rows, @render.rows через simParallelFor
+  // (SIM_THREADS потоков) кусками по --heat-grain строк. Каждая функция
+  // компилируется при первом вызове
   auto* appTy = FunctionType::get(voidTy, false);
-  auto* appFn = Function::Create(appTy, Function::ExternalLinkage, "app", M.get());
-  auto* entry = BasicBlock::Create(C, "entry", appFn);
+  auto* stepTy = FunctionType::get(voidTy, {i32}, false);
+  auto* appFn = Function::Create(FunctionType::get(voidTy, {PointerType::getUnqual(stepTy)}, false),
+                                 Function::ExternalLinkage, "app", M.get());
+  auto* initFn = Function::Create(appTy, Function::ExternalLinkage, "init", M.get());
+  auto* heatFn = Function::Create(appTy, Function::ExternalLinkage, "heat", M.get());
+  auto* renderFn = Function::Create(appTy, Function::ExternalLinkage, "render", M.get());
+  auto* heatRowsFn = Function::Create(rowsTy, Function::ExternalLinkage, "heat.rows", M.get());
+  auto* renderRowsFn = Function::Create(rowsTy, Function::ExternalLinkage, "render.rows", M.get());
+  const int GRAIN = (int)simOptionInt("heat-grain", std::max(1, 32768 / W));
+
+  // Специализации шага бок о бок: цикл диффузии с подсказками векторизатору
+  // (ширина x чередование; auto - на его усмотрение). Какая быстрее на этой
+  // машине и сетке, решает калибровка перед запуском (см. конец main)
+  // simd<N> - строка сразу в векторном IR (<N x i32>, для u8 - <N x i8> со счётом
+  // в <N x i16>), N по ширине векторов хоста; от векторизатора не зависит
+  struct StepVariant { std::string name; unsigned width, interleave, simd; Function *step, *diffuse, *rows; };
+  std::vector<StepVariant> variants;
+  const unsigned lanes = narrow ? 4 : 1;        // i8 - вчетверо больше клеток в регистре
+  const unsigned vecBits = hostVectorBits();
+  const unsigned simdN = vecBits / (narrow ? 16 : 32);
+  for (auto hint : { std::pair<unsigned, unsigned>{0, 0}, {8, 1}, {8, 4}, {16, 2} }) {
+    const unsigned w = hint.first, ic = hint.second;
+    std::string name = w ? "v" + std::to_string(w * lanes) + "x" + std::to_string(ic) : "auto";
+    variants.push_back({ name, w * lanes, ic, 0,
+                         Function::Create(stepTy, Function::ExternalLinkage, "step." + name, M.get()),
+                         Function::Create(appTy, Function::ExternalLinkage, "diffuse." + name, M.get()),
+                         Function::Create(rowsTy, Function::ExternalLinkage, "diffuse." + name + ".rows", M.get()) });
+  }
+  if ((unsigned)W - 2 >= simdN) {
+    std::string name = "simd" + std::to_string(simdN);
+    variants.push_back({ name, 0, 0, simdN,
+                         Function::Create(stepTy, Function::ExternalLinkage, "step." + name, M.get()),
+                         Function::Create(appTy, Function::ExternalLinkage, "diffuse." + name, M.get()),
+                         Function::Create(rowsTy, Function::ExternalLinkage, "diffuse." + name + ".rows", M.get()) });
+    // без этого x86 с prefer-vector-width=256 режет 512-битные типы пополам
+    variants.back().rows->addFnAttr("min-legal-vector-width", std::to_string(vecBits));
+  }
+  auto* entry = BasicBlock::Create(C, "entry", initFn);
   B.SetInsertPoint(entry);
 
   auto c0    = ConstantInt::get(i32, 0);
@@ -89,8 +400,16 @@ int main() {
   auto cSRC  = ConstantInt::get(i32, SOURCES);
   auto cSteps= ConstantInt::get(i32, STEPS_PER_FRAME);
   auto cCooling = ConstantInt::get(i32, COOLING);
-  auto cSIMX = ConstantInt::get(i32, SIM_X_SIZE);
-  auto cSIMY = ConstantInt::get(i32, SIM_Y_SIZE);
+  auto cZero = ConstantInt::get(cellTy, 0);
+
+  // Клетки считаются в i32: загрузка с zext, запись с trunc (для i8)
+  auto loadCell = [&](Value* p)->Value*{
+    Value* v = B.CreateLoad(cellTy, p);
+    return narrow ? B.CreateZExt(v, i32) : v;
+  };
+  auto storeCell = [&](Value* v, Value* p){
+    B.CreateStore(narrow ? B.CreateTrunc(v, cellTy) : v, p);
+  };
 
   // Вспомогалки для массивов источников
   auto loadArr = [&](GlobalVariable* gv, Value* idx)->Value*{
@@ -103,9 +422,9 @@ int main() {
   };
 
   // ===== Инициализация источников =====
-  auto *I  = BasicBlock::Create(C,"init.i",appFn);
-  auto *Ib = BasicBlock::Create(C,"init.body",appFn);
-  auto *Ie = BasicBlock::Create(C,"init.end",appFn);
+  auto *I  = BasicBlock::Create(C,"init.i",initFn);
+  auto *Ib = BasicBlock::Create(C,"init.body",initFn);
+  auto *Ie = BasicBlock::Create(C,"init.end",initFn);
   B.CreateBr(I);
 
   B.SetInsertPoint(I);
@@ -150,8 +469,20 @@ int main() {
   i->addIncoming(inext, Ib);
   B.CreateBr(I);
 
-  // ===== Главный цикл по кадрам =====
   B.SetInsertPoint(Ie);
+  if (Restore.path && *Restore.path) {
+    auto* ptrTy = PointerType::getUnqual(Type::getInt8Ty(C));
+    auto fRestore = ext(*M, "appRestore", voidTy, {ptrTy, i32p, i32p, i32p, i32p, i32p, i32p});
+    auto arg = [&](GlobalVariable* gv) { return B.CreatePointerCast(gv, i32p); };
+    B.CreateCall(fRestore, { B.CreatePointerCast(B.CreateLoad(fieldp, Cur), ptrTy), arg(sx), arg(sy), arg(svx), arg(svy),
+                             arg(sr), arg(st) });
+  }
+  B.CreateRetVoid();
+
+  // ===== Главный цикл по кадрам =====
+  auto* appEntry = BasicBlock::Create(C, "entry", appFn);
+  B.SetInsertPoint(appEntry);
+  B.CreateCall(initFn);
   auto *F   = BasicBlock::Create(C,"frame.i",appFn);
   auto *Fb  = BasicBlock::Create(C,"frame.b",appFn);
   auto *Fe  = BasicBlock::Create(C,"frame.e",appFn);
@@ -159,7 +490,7 @@ int main() {
 
   B.SetInsertPoint(F);
   auto* f = B.CreatePHI(i32,2);
-  f->addIncoming(c0, Ie);
+  f->addIncoming(c0, appEntry);
   B.CreateCondBr(B.CreateICmpSLT(f, ConstantInt::get(i32,1000000)), Fb, Fe);
 
   // ---- Движение источников ----
@@ -205,40 +536,67 @@ int main() {
   k->addIncoming(kn, Mb);
   B.CreateBr(Mi);
 
-  // ---- STEPS_PER_FRAME: HEAT(U0) -> DIFF(U1) -> EDGES(U1=0) -> COPY(U1->U0) ----
+  // ---- STEPS_PER_FRAME: HEAT(cur) -> DIFF(cur -> next, края = 0) -> swap(cur, next) ----
   B.SetInsertPoint(Me);
-  auto *Si = BasicBlock::Create(C,"step.i",appFn);
-  auto *Sb = BasicBlock::Create(C,"step.b",appFn);
-  auto *Se = BasicBlock::Create(C,"step.e",appFn);
-  B.CreateBr(Si);
-
-  B.SetInsertPoint(Si);
-  auto* s = B.CreatePHI(i32,2);
-  s->addIncoming(c0, Me);
-  B.CreateCondBr(B.CreateICmpSLT(s,cSteps), Sb, Se);
-
-  // === HEAT на U0 (диски) ===
-  B.SetInsertPoint(Sb);
-  auto *Hi = BasicBlock::Create(C,"heat.i",appFn);
-  auto *Hb = BasicBlock::Create(C,"heat.b",appFn);
-  auto *He = BasicBlock::Create(C,"heat.e",appFn);
+  auto* Rn = BasicBlock::Create(C,"render",appFn);
+  B.CreateCall(stepTy, appFn->getArg(0), {cSteps});
+  B.CreateBr(Rn);
+
+  for (auto& v : variants) {
+    Function* stepFn = v.step;
+    auto* stepEntry = BasicBlock::Create(C,"entry",stepFn);
+    auto *Si = BasicBlock::Create(C,"step.i",stepFn);
+    auto *Sb = BasicBlock::Create(C,"step.b",stepFn);
+    auto *Se = BasicBlock::Create(C,"step.e",stepFn);
+    B.SetInsertPoint(stepEntry);
+    B.CreateBr(Si);
+
+    B.SetInsertPoint(Si);
+    auto* s = B.CreatePHI(i32,2);
+    s->addIncoming(c0, stepEntry);
+    B.CreateCondBr(B.CreateICmpSLT(s, stepFn->getArg(0)), Sb, Se);
+
+    B.SetInsertPoint(Sb);
+    B.CreateCall(heatFn);
+    B.CreateCall(v.diffuse);
+    auto sn = B.CreateAdd(s,c1);
+    s->addIncoming(sn, Sb);
+    B.CreateBr(Si);
+
+    B.SetInsertPoint(Se);
+    B.CreateRetVoid();
+  }
+
+  // === HEAT на cur (диски): строки [1, H-1) кусками, @heat.rows(y0, y1) рисует
+  // части дисков, попавшие в [y0, y1) ===
+  B.SetInsertPoint(BasicBlock::Create(C,"entry",heatFn));
+  B.CreateCall(fParFor, { heatRowsFn, c1, B.CreateSub(cH,c1), ConstantInt::get(i32, GRAIN) });
+  B.CreateRetVoid();
+
+  auto* heatEntry = BasicBlock::Create(C,"entry",heatRowsFn);
+  B.SetInsertPoint(heatEntry);
+  Value* heatBuf = B.CreateLoad(fieldp, Cur);
+  auto *Hi = BasicBlock::Create(C,"heat.i",heatRowsFn);
+  auto *Hb = BasicBlock::Create(C,"heat.b",heatRowsFn);
+  auto *He = BasicBlock::Create(C,"heat.e",heatRowsFn);
   B.CreateBr(Hi);
 
   B.SetInsertPoint(Hi);
   auto* h = B.CreatePHI(i32,2);
-  h->addIncoming(c0, Sb);
+  h->addIncoming(c0, heatEntry);
   B.CreateCondBr(B.CreateICmpSLT(h,cSRC), Hb, He);
 
   B.SetInsertPoint(Hb);
   {
     auto cx = loadArr(sx,h), cy = loadArr(sy,h), rr = loadArr(sr,h), tt = loadArr(st,h);
-    auto r2 = B.CreateMul(rr, rr);
+    auto spanBase = B.CreateLShr(B.CreateMul(rr, B.CreateAdd(rr, c1)), c1);
 
+    // диск по y обрезан куском строк (внутри которого и края сетки)
     auto y0 = B.CreateSub(cy, rr);
-    y0 = B.CreateSelect(B.CreateICmpSLT(y0, ConstantInt::get(i32,1)), ConstantInt::get(i32,1), y0);
+    y0 = B.CreateSelect(B.CreateICmpSLT(y0, heatRowsFn->getArg(0)), heatRowsFn->getArg(0), y0);
     auto y1 = B.CreateAdd(cy, rr);
-    y1 = B.CreateSelect(B.CreateICmpSGT(y1, B.CreateSub(cH, ConstantInt::get(i32,2))),
-                        B.CreateSub(cH, ConstantInt::get(i32,2)), y1);
+    auto yLast = B.CreateSub(heatRowsFn->getArg(1), c1);
+    y1 = B.CreateSelect(B.CreateICmpSGT(y1, yLast), yLast, y1);
     auto x0 = B.CreateSub(cx, rr);
     x0 = B.CreateSelect(B.CreateICmpSLT(x0, ConstantInt::get(i32,1)), ConstantInt::get(i32,1), x0);
     auto x1 = B.CreateAdd(cx, rr);
@@ -246,9 +604,9 @@ int main() {
                         B.CreateSub(cW, ConstantInt::get(i32,2)), x1);
 
     // y-loop
-    auto *YI=BasicBlock::Create(C,"heat.y.i",appFn);
-    auto *YB=BasicBlock::Create(C,"heat.y.b",appFn);
-    auto *YE=BasicBlock::Create(C,"heat.y.e",appFn);
+    auto *YI=BasicBlock::Create(C,"heat.y.i",heatRowsFn);
+    auto *YB=BasicBlock::Create(C,"heat.y.b",heatRowsFn);
+    auto *YE=BasicBlock::Create(C,"heat.y.e",heatRowsFn);
     B.CreateBr(YI);
 
     B.SetInsertPoint(YI);
@@ -256,36 +614,36 @@ int main() {
     yy->addIncoming(y0, Hb);
     B.CreateCondBr(B.CreateICmpSLE(yy, y1), YB, YE);
 
+    // строка диска: [cx - hw, cx + hw] из таблицы, обрезанная по [x0, x1]
     B.SetInsertPoint(YB);
     auto dy  = B.CreateSub(yy, cy);
-    auto dy2 = B.CreateMul(dy, dy);
+    auto ady = B.CreateSelect(B.CreateICmpSLT(dy, c0), B.CreateSub(c0, dy), dy);
+    Value* si[2] = { c0, B.CreateAdd(spanBase, ady) };
+    auto hw  = B.CreateLoad(i32, B.CreateInBoundsGEP(spanTy, diskSpan, si));
+    auto xa  = B.CreateSub(cx, hw);
+    xa = B.CreateSelect(B.CreateICmpSLT(xa, x0), x0, xa);
+    auto xb  = B.CreateAdd(cx, hw);
+    xb = B.CreateSelect(B.CreateICmpSGT(xb, x1), x1, xb);
 
     // x-loop
-    auto *XI=BasicBlock::Create(C,"heat.x.i",appFn);
-    auto *XB=BasicBlock::Create(C,"heat.x.b",appFn);
-    auto *XE=BasicBlock::Create(C,"heat.x.e",appFn);
+    auto *XI=BasicBlock::Create(C,"heat.x.i",heatRowsFn);
+    auto *XB=BasicBlock::Create(C,"heat.x.b",heatRowsFn);
+    auto *XE=BasicBlock::Create(C,"heat.x.e",heatRowsFn);
     B.CreateBr(XI);
 
     B.SetInsertPoint(XI);
     auto* xx = B.CreatePHI(i32,2);
-    xx->addIncoming(x0, YB);
-    B.CreateCondBr(B.CreateICmpSLE(xx, x1), XB, XE);
+    xx->addIncoming(xa, YB);
+    B.CreateCondBr(B.CreateICmpSLE(xx, xb), XB, XE);
 
+    // без ветвлений: max-заливка отрезка, которую векторизатор может развернуть
     B.SetInsertPoint(XB);
-    auto dx = B.CreateSub(xx, cx);
-    auto inDisk = B.CreateICmpSLE(B.CreateAdd(B.CreateMul(dx,dx), dy2), r2);
-    auto* p = gep2D(B,C,U0,H,W,yy,xx);
-    auto  ov = B.CreateLoad(i32, p);
-    auto  mv = B.CreateSelect(B.CreateICmpSLT(ov, tt), tt, ov);
-
-    auto *WT = BasicBlock::Create(C,"heat.write",appFn);
-    auto *CT = BasicBlock::Create(C,"heat.cont",appFn);
-    B.CreateCondBr(inDisk, WT, CT);
-    B.SetInsertPoint(WT); B.CreateStore(mv,p); B.CreateBr(CT);
-    B.SetInsertPoint(CT);
+    auto* p = gep2D(B,C,cellTy,heatBuf,H,W,yy,xx);
+    auto  ov = loadCell(p);
+    storeCell(B.CreateSelect(B.CreateICmpSLT(ov, tt), tt, ov), p);
 
     auto xxn = B.CreateAdd(xx, c1);
-    xx->addIncoming(xxn, CT);
+    xx->addIncoming(xxn, XB);
     B.CreateBr(XI);
 
     B.SetInsertPoint(XE);
@@ -300,248 +658,409 @@ int main() {
   h->addIncoming(hn, /* backedge */ B.GetInsertBlock()); // YE
   B.CreateBr(Hi);
 
-  // === DIFF: U1 = u + (lap>>2) - COOLING (внутренние узлы) ===
+  // === DIFF: next = u + (lap>>2) - COOLING; края next обнуляются в том же
+  // проходе (как heatDiffuseRows в SDL/heat.c), строки [0, H) кусками,
+  // затем смена буферов ===
   B.SetInsertPoint(He);
-  auto *DyI=BasicBlock::Create(C,"diff.y.i",appFn);
-  auto *DyB=BasicBlock::Create(C,"diff.y.b",appFn);
-  auto *DyE=BasicBlock::Create(C,"diff.y.e",appFn);
-  B.CreateBr(DyI);
-
-  B.SetInsertPoint(DyI);
-  auto* y = B.CreatePHI(i32,2);
-  y->addIncoming(ConstantInt::get(i32,1), He);
-  B.CreateCondBr(B.CreateICmpSLT(y, B.CreateSub(cH,c1)), DyB, DyE);
-
-  B.SetInsertPoint(DyB);
-  auto *DxI=BasicBlock::Create(C,"diff.x.i",appFn);
-  auto *DxB=BasicBlock::Create(C,"diff.x.b",appFn);
-  auto *DxE=BasicBlock::Create(C,"diff.x.e",appFn);
-  B.CreateBr(DxI);
-
-  B.SetInsertPoint(DxI);
-  auto* x = B.CreatePHI(i32,2);
-  x->addIncoming(ConstantInt::get(i32,1), DyB);
-  B.CreateCondBr(B.CreateICmpSLT(x, B.CreateSub(cW,c1)), DxB, DxE);
-
-  B.SetInsertPoint(DxB);
-  {
-    auto up = B.CreateLoad(i32, gep2D(B,C,U0,H,W, B.CreateSub(y,c1), x));
-    auto dn = B.CreateLoad(i32, gep2D(B,C,U0,H,W, B.CreateAdd(y,c1), x));
-    auto lf = B.CreateLoad(i32, gep2D(B,C,U0,H,W, y, B.CreateSub(x,c1)));
-    auto rt = B.CreateLoad(i32, gep2D(B,C,U0,H,W, y, B.CreateAdd(x,c1)));
-    auto ce = B.CreateLoad(i32, gep2D(B,C,U0,H,W, y, x));
-    auto lap = B.CreateSub(B.CreateAdd(B.CreateAdd(B.CreateAdd(up,dn),lf),rt),
-                           B.CreateMul(ce, ConstantInt::get(i32,4)));
-    auto un  = B.CreateSub(B.CreateAdd(ce, B.CreateAShr(lap, ConstantInt::get(i32,2))), ConstantInt::get(i32, COOLING));
-    auto u0  = B.CreateSelect(B.CreateICmpSLT(un, c0), c0, un);
-    auto u1  = B.CreateSelect(B.CreateICmpSGT(u0, c255), c255, u0);
-    B.CreateStore(u1, gep2D(B,C,U1,H,W, y, x));
-  }
-  auto xn = B.CreateAdd(x,c1);
-  x->addIncoming(xn, DxB);
-  B.CreateBr(DxI);
-
-  B.SetInsertPoint(DxE);
-  auto yn = B.CreateAdd(y,c1);
-  y->addIncoming(yn, DxE);
-  B.CreateBr(DyI);
-
-  // === EDGES: U1 на границах = 0 ===
-  B.SetInsertPoint(DyE);
-  // top/bottom
-  auto *EtI=BasicBlock::Create(C,"edge.t.i",appFn);
-  auto *EtB=BasicBlock::Create(C,"edge.t.b",appFn);
-  auto *EtE=BasicBlock::Create(C,"edge.t.e",appFn);
-  B.CreateBr(EtI);
-
-  B.SetInsertPoint(EtI);
-  auto* ex = B.CreatePHI(i32,2);
-  ex->addIncoming(c0, DyE);
-  B.CreateCondBr(B.CreateICmpSLT(ex, cW), EtB, EtE);
-
-  B.SetInsertPoint(EtB);
-  B.CreateStore(c0, gep2D(B,C,U1,H,W, c0, ex));
-  B.CreateStore(c0, gep2D(B,C,U1,H,W, B.CreateSub(cH,c1), ex));
-  auto exn = B.CreateAdd(ex,c1);
-  ex->addIncoming(exn, EtB);
-  B.CreateBr(EtI);
-
-  B.SetInsertPoint(EtE);
-  // left/right
-  auto *ElI=BasicBlock::Create(C,"edge.l.i",appFn);
-  auto *ElB=BasicBlock::Create(C,"edge.l.b",appFn);
-  auto *ElE=BasicBlock::Create(C,"edge.l.e",appFn);
-  B.CreateBr(ElI);
-
-  B.SetInsertPoint(ElI);
-  auto* ey = B.CreatePHI(i32,2);
-  ey->addIncoming(c0, EtE);
-  B.CreateCondBr(B.CreateICmpSLT(ey, cH), ElB, ElE);
-
-  B.SetInsertPoint(ElB);
-  B.CreateStore(c0, gep2D(B,C,U1,H,W, ey, c0));
-  B.CreateStore(c0, gep2D(B,C,U1,H,W, ey, B.CreateSub(cW,c1)));
-  auto eyn = B.CreateAdd(ey,c1);
-  ey->addIncoming(eyn, ElB);
-  B.CreateBr(ElI);
-
-  // === COPY: U1 -> U0 ===
-  B.SetInsertPoint(ElE);
-  auto *CyI=BasicBlock::Create(C,"cpy.y.i",appFn);
-  auto *CyB=BasicBlock::Create(C,"cpy.y.b",appFn);
-  auto *CyE=BasicBlock::Create(C,"cpy.y.e",appFn);
-  B.CreateBr(CyI);
-
-  B.SetInsertPoint(CyI);
-  auto* cy = B.CreatePHI(i32,2);
-  cy->addIncoming(c0, ElE);
-  B.CreateCondBr(B.CreateICmpSLT(cy, cH), CyB, CyE);
-
-  B.SetInsertPoint(CyB);
-  auto *CxI=BasicBlock::Create(C,"cpy.x.i",appFn);
-  auto *CxB=BasicBlock::Create(C,"cpy.x.b",appFn);
-  auto *CxE=BasicBlock::Create(C,"cpy.x.e",appFn);
-  B.CreateBr(CxI);
-
-  B.SetInsertPoint(CxI);
-  auto* cx = B.CreatePHI(i32,2);
-  cx->addIncoming(c0, CyB);
-  B.CreateCondBr(B.CreateICmpSLT(cx, cW), CxB, CxE);
-
-  B.SetInsertPoint(CxB);
-  auto vv = B.CreateLoad(i32, gep2D(B,C,U1,H,W, cy, cx));
-  B.CreateStore(vv,          gep2D(B,C,U0,H,W, cy, cx));
-  auto cxn = B.CreateAdd(cx,c1);
-  cx->addIncoming(cxn, CxB);
-  B.CreateBr(CxI);
-
-  B.SetInsertPoint(CxE);
-  auto cyn = B.CreateAdd(cy,c1);
-  cy->addIncoming(cyn, CxE);
-  B.CreateBr(CyI);
-
-  // step++
-  B.SetInsertPoint(CyE);
-  auto sn = B.CreateAdd(s,c1);
-  s->addIncoming(sn, CyE);
-  B.CreateBr(Si);
-
-  // ===== Рендер из U0 =====
-  B.SetInsertPoint(Se);
-  auto *RyI=BasicBlock::Create(C,"ry.i",appFn);
-  auto *RyB=BasicBlock::Create(C,"ry.b",appFn);
-  auto *RyE=BasicBlock::Create(C,"ry.e",appFn);
-  B.CreateBr(RyI);
-
-  B.SetInsertPoint(RyI);
-  auto* gy = B.CreatePHI(i32,2);
-  gy->addIncoming(c0, Se);
-  B.CreateCondBr(B.CreateICmpSLT(gy, cH), RyB, RyE);
-
-  B.SetInsertPoint(RyB);
-  auto *RxI=BasicBlock::Create(C,"rx.i",appFn);
-  auto *RxB=BasicBlock::Create(C,"rx.b",appFn);
-  auto *RxE=BasicBlock::Create(C,"rx.e",appFn);
-  B.CreateBr(RxI);
-
-  B.SetInsertPoint(RxI);
-  auto* gx = B.CreatePHI(i32,2);
-  gx->addIncoming(c0, RyB);
-  B.CreateCondBr(B.CreateICmpSLT(gx, cW), RxB, RxE);
-
-  B.SetInsertPoint(RxB);
-  {
-    auto T  = B.CreateLoad(i32, gep2D(B,C,U0,H,W, gy, gx));
-    auto Tc = B.CreateSelect(B.CreateICmpSLT(T,c0), c0,
-                 B.CreateSelect(B.CreateICmpSGT(T,c255), c255, T));
-    auto r  = Tc;
-    auto g  = B.CreateLShr(Tc, ConstantInt::get(i32,1));
-    auto b  = B.CreateSub(c255, Tc);
-    auto color = B.CreateOr(
-                   B.CreateOr(ConstantInt::get(i32,0xFF000000), B.CreateShl(r, ConstantInt::get(i32,16))),
-                   B.CreateOr(B.CreateShl(g, ConstantInt::get(i32,8)), b));
-
-    auto x0p = B.CreateMul(gx, cCELL);
-    auto y0p = B.CreateMul(gy, cCELL);
-
-    auto *PyI=BasicBlock::Create(C,"py.i",appFn);
-    auto *PyB=BasicBlock::Create(C,"py.b",appFn);
-    auto *PyE=BasicBlock::Create(C,"py.e",appFn);
-    B.CreateBr(PyI);
-
-    B.SetInsertPoint(PyI);
-    auto* py = B.CreatePHI(i32,2);
-    py->addIncoming(c0, RxB);
-    auto ypix = B.CreateAdd(y0p, py);
-    auto yOk  = B.CreateICmpSLT(ypix, cSIMY);
-    B.CreateCondBr(B.CreateAnd(B.CreateICmpSLT(py, cCELL), yOk), PyB, PyE);
-
-    B.SetInsertPoint(PyB);
-    auto *PxI=BasicBlock::Create(C,"px.i",appFn);
-    auto *PxB=BasicBlock::Create(C,"px.b",appFn);
-    auto *PxE=BasicBlock::Create(C,"px.e",appFn);
-    B.CreateBr(PxI);
-
-    B.SetInsertPoint(PxI);
-    auto* px = B.CreatePHI(i32,2);
-    px->addIncoming(c0, PyB);
-    auto xpix = B.CreateAdd(x0p, px);
-    auto xOk  = B.CreateICmpSLT(xpix, cSIMX);
-    B.CreateCondBr(B.CreateAnd(B.CreateICmpSLT(px, cCELL), xOk), PxB, PxE);
-
-    B.SetInsertPoint(PxB);
-    B.CreateCall(fPut, { xpix, ypix, color });
-    auto pxn = B.CreateAdd(px,c1);
-    px->addIncoming(pxn, PxB);
-    B.CreateBr(PxI);
-
-    B.SetInsertPoint(PxE);
-    auto pyn = B.CreateAdd(py,c1);
-    py->addIncoming(pyn, PxE);
-    B.CreateBr(PyI);
-
-    B.SetInsertPoint(PyE);
-    auto gxn = B.CreateAdd(gx,c1);
-    gx->addIncoming(gxn, PyE);
-    B.CreateBr(RxI);
-  }
+  B.CreateRetVoid();
 
-  B.SetInsertPoint(RxE);
-  auto gyn = B.CreateAdd(gy,c1);
-  gy->addIncoming(gyn, RxE);
-  B.CreateBr(RyI);
+  for (auto& v : variants) {
+    B.SetInsertPoint(BasicBlock::Create(C,"entry",v.diffuse));
+    B.CreateCall(fParFor, { v.rows, c0, cH, ConstantInt::get(i32, GRAIN) });
+    // === swap(cur, next) вместо копирования next -> cur ===
+    Value* was = B.CreateLoad(fieldp, Cur);
+    B.CreateStore(B.CreateLoad(fieldp, Nxt), Cur);
+    B.CreateStore(was, Nxt);
+    B.CreateRetVoid();
+
+    Function* fn = v.rows;
+    auto* diffEntry = BasicBlock::Create(C,"entry",fn);
+    B.SetInsertPoint(diffEntry);
+    Value* cur = B.CreateLoad(fieldp, Cur);
+    Value* next = B.CreateLoad(fieldp, Nxt);
+    auto *DyI=BasicBlock::Create(C,"diff.y.i",fn);
+    auto *DyB=BasicBlock::Create(C,"diff.y.b",fn);
+    auto *DyEdge=BasicBlock::Create(C,"diff.y.edge",fn);
+    auto *DyN=BasicBlock::Create(C,"diff.y.n",fn);
+    auto *DyE=BasicBlock::Create(C,"diff.y.e",fn);
+    B.CreateBr(DyI);
+
+    B.SetInsertPoint(DyI);
+    auto* y = B.CreatePHI(i32,2);
+    y->addIncoming(fn->getArg(0), diffEntry);
+    B.CreateCondBr(B.CreateICmpSLT(y, fn->getArg(1)), DyB, DyE);
+
+    // верхняя и нижняя строки - нули целиком
+    B.SetInsertPoint(DyB);
+    auto *DxPre=BasicBlock::Create(C,"diff.x.pre",fn);
+    B.CreateCondBr(B.CreateOr(B.CreateICmpEQ(y, c0), B.CreateICmpEQ(y, B.CreateSub(cH,c1))), DyEdge, DxPre);
+
+    B.SetInsertPoint(DyEdge);
+    B.CreateMemSet(gep2D(B,C,cellTy,next,H,W, y, c0), ConstantInt::get(Type::getInt8Ty(C), 0),
+                   (uint64_t)W * cellTy->getPrimitiveSizeInBits() / 8, MaybeAlign(1));
+    B.CreateBr(DyN);
+
+    // внутренняя строка: крайние клетки - нули, между ними - шаблон
+    B.SetInsertPoint(DxPre);
+    B.CreateStore(cZero, gep2D(B,C,cellTy,next,H,W, y, c0));
+    B.CreateStore(cZero, gep2D(B,C,cellTy,next,H,W, y, B.CreateSub(cW,c1)));
+    auto *DxI=BasicBlock::Create(C,"diff.x.i",fn);
+    auto *DxB=BasicBlock::Create(C,"diff.x.b",fn);
+    BasicBlock* scalarFrom = DxPre;
+    Value* scalarX = c1;
+    if (v.simd) {
+      // по N клеток: невыровненные загрузки соседей, clamp через smax/smin,
+      // остаток строки (< N) - скалярный цикл ниже
+      auto* lane = narrow ? Type::getInt16Ty(C) : i32;
+      auto* vecCell = FixedVectorType::get(cellTy, v.simd);
+      auto* vecLane = FixedVectorType::get(lane, v.simd);
+      auto* vecCellp = PointerType::getUnqual(vecCell);
+      auto cN = ConstantInt::get(i32, v.simd);
+      auto *VxI=BasicBlock::Create(C,"diff.v.i",fn);
+      auto *VxB=BasicBlock::Create(C,"diff.v.b",fn);
+      B.CreateBr(VxI);
+
+      B.SetInsertPoint(VxI);
+      auto* vx = B.CreatePHI(i32,2);
+      vx->addIncoming(c1, DxPre);
+      B.CreateCondBr(B.CreateICmpSLE(B.CreateAdd(vx, cN), B.CreateSub(cW,c1)), VxB, DxI);
+
+      B.SetInsertPoint(VxB);
+      auto loadVec = [&](Value* yy, Value* xx) -> Value* {
+        Value* p = B.CreatePointerCast(gep2D(B,C,cellTy,cur,H,W, yy, xx), vecCellp);
+        Value* v = B.CreateAlignedLoad(vecCell, p, MaybeAlign(1));
+        return narrow ? B.CreateZExt(v, vecLane) : v;
+      };
+      auto up = loadVec(B.CreateSub(y,c1), vx);
+      auto dn = loadVec(B.CreateAdd(y,c1), vx);
+      auto lf = loadVec(y, B.CreateSub(vx,c1));
+      auto rt = loadVec(y, B.CreateAdd(vx,c1));
+      auto ce = loadVec(y, vx);
+      auto lap = B.CreateSub(B.CreateAdd(B.CreateAdd(B.CreateAdd(up,dn),lf),rt),
+                             B.CreateShl(ce, ConstantInt::get(vecLane, 2)));
+      auto un = B.CreateSub(B.CreateAdd(ce, B.CreateAShr(lap, ConstantInt::get(vecLane, 2))),
+                            ConstantInt::get(vecLane, COOLING));
+      un = B.CreateBinaryIntrinsic(Intrinsic::smax, un, ConstantInt::get(vecLane, 0));
+      un = B.CreateBinaryIntrinsic(Intrinsic::smin, un, ConstantInt::get(vecLane, 255));
+      if (narrow) un = B.CreateTrunc(un, vecCell);
+      B.CreateAlignedStore(un, B.CreatePointerCast(gep2D(B,C,cellTy,next,H,W, y, vx), vecCellp),
+                           MaybeAlign(1));
+      vx->addIncoming(B.CreateAdd(vx, cN), VxB);
+      B.CreateBr(VxI);
+      scalarFrom = VxI;
+      scalarX = vx;
+    } else {
+      B.CreateBr(DxI);
+    }
+
+    B.SetInsertPoint(DxI);
+    auto* x = B.CreatePHI(i32,2);
+    x->addIncoming(scalarX, scalarFrom);
+    B.CreateCondBr(B.CreateICmpSLT(x, B.CreateSub(cW,c1)), DxB, DyN);
+
+    B.SetInsertPoint(DxB);
+    {
+      auto up = loadCell(gep2D(B,C,cellTy,cur,H,W, B.CreateSub(y,c1), x));
+      auto dn = loadCell(gep2D(B,C,cellTy,cur,H,W, B.CreateAdd(y,c1), x));
+      auto lf = loadCell(gep2D(B,C,cellTy,cur,H,W, y, B.CreateSub(x,c1)));
+      auto rt = loadCell(gep2D(B,C,cellTy,cur,H,W, y, B.CreateAdd(x,c1)));
+      auto ce = loadCell(gep2D(B,C,cellTy,cur,H,W, y, x));
+      auto lap = B.CreateSub(B.CreateAdd(B.CreateAdd(B.CreateAdd(up,dn),lf),rt),
+                             B.CreateMul(ce, ConstantInt::get(i32,4)));
+      auto un  = B.CreateSub(B.CreateAdd(ce, B.CreateAShr(lap, ConstantInt::get(i32,2))), ConstantInt::get(i32, COOLING));
+      auto u0  = B.CreateSelect(B.CreateICmpSLT(un, c0), c0, un);
+      auto u1  = B.CreateSelect(B.CreateICmpSGT(u0, c255), c255, u0);
+      storeCell(u1, gep2D(B,C,cellTy,next,H,W, y, x));
+    }
+    auto xn = B.CreateAdd(x,c1);
+    x->addIncoming(xn, DxB);
+    auto* xBack = B.CreateBr(DxI);
+    if (v.width) {
+      auto hint = [&](const char* n, unsigned val) -> Metadata* {
+        return MDNode::get(C, { MDString::get(C, n), ConstantAsMetadata::get(ConstantInt::get(i32, val)) });
+      };
+      Metadata* ops[] = { nullptr,                // ссылка на себя, как требует !llvm.loop
+                          MDNode::get(C, { MDString::get(C, "llvm.loop.vectorize.enable"),
+                                           ConstantAsMetadata::get(B.getTrue()) }),
+                          hint("llvm.loop.vectorize.width", v.width),
+                          hint("llvm.loop.interleave.count", v.interleave) };
+      MDNode* loop = MDNode::getDistinct(C, ops);
+      loop->replaceOperandWith(0, loop);
+      xBack->setMetadata(LLVMContext::MD_loop, loop);
+    }
+
+    B.SetInsertPoint(DyN);
+    auto yn = B.CreateAdd(y,c1);
+    y->addIncoming(yn, DyN);
+    B.CreateBr(DyI);
+
+    B.SetInsertPoint(DyE);
+    B.CreateRetVoid();
+  }
 
-  B.SetInsertPoint(RyE);
+  B.SetInsertPoint(Rn);
+  B.CreateCall(renderFn);
   B.CreateCall(fFlush);
   auto fn = B.CreateAdd(f,c1);
-  f->addIncoming(fn, RyE);
+  f->addIncoming(fn, Rn);
   B.CreateBr(F);
 
   // exit
   B.SetInsertPoint(Fe);
   B.CreateRetVoid();
 
+  // ===== Рендер из cur прямо в кадр: клетка -> palette -> квадрат CELL x CELL,
+  // всё за краем окна отбрасывается (как simBlitCells); строки клеток кусками
+  // в @render.rows, затем одна грязная область на всю сетку =====
+  const int COLS = std::min(W * CELL, SIM_X_SIZE);                 // пикселей в строке
+  const int RROWS = std::min(H, (SIM_Y_SIZE + CELL - 1) / CELL);   // видимых строк клеток
+  B.SetInsertPoint(BasicBlock::Create(C,"entry",renderFn));
+  B.CreateCall(fCells, { ConstantInt::get(Type::getInt64Ty(C), (int64_t)W * H * STEPS_PER_FRAME) });
+  B.CreateCall(fParFor, { renderRowsFn, c0, ConstantInt::get(i32, RROWS), ConstantInt::get(i32, GRAIN) });
+  B.CreateCall(fDirty, { c0, c0, ConstantInt::get(i32, COLS), ConstantInt::get(i32, std::min(H * CELL, SIM_Y_SIZE)) });
+  B.CreateRetVoid();
+
+  {
+    Function* fn = renderRowsFn;
+    auto* rEntry = BasicBlock::Create(C,"entry",fn);
+    B.SetInsertPoint(rEntry);
+    Value* fb = B.CreateCall(fFrame);
+    Value* buf = B.CreateLoad(fieldp, Cur);
+    auto *RyI=BasicBlock::Create(C,"render.y.i",fn);
+    auto *RyB=BasicBlock::Create(C,"render.y.b",fn);
+    auto *RyE=BasicBlock::Create(C,"render.y.e",fn);
+    B.CreateBr(RyI);
+
+    B.SetInsertPoint(RyI);
+    auto* gy = B.CreatePHI(i32,2);
+    gy->addIncoming(fn->getArg(0), rEntry);
+    B.CreateCondBr(B.CreateICmpSLT(gy, fn->getArg(1)), RyB, RyE);
+
+    // клетка gx: цвет из палитры, CELL пикселей подряд (n < CELL - у края окна);
+    // цикл по пикселям развёрнут здесь же, CELL - константа
+    B.SetInsertPoint(RyB);
+    auto py0 = B.CreateMul(gy, cCELL);
+    auto rowBase = B.CreateMul(py0, ConstantInt::get(i32, SIM_X_SIZE));
+    auto putCell = [&](Value* gx, int n) {
+      Value* T = loadCell(gep2D(B,C,cellTy,buf,H,W, gy, gx));
+      if (!narrow) {
+        T = B.CreateBinaryIntrinsic(Intrinsic::smax, T, c0);
+        T = B.CreateBinaryIntrinsic(Intrinsic::smin, T, c255);
+      }
+      Value* pi[2] = { c0, T };
+      Value* color = B.CreateLoad(i32, B.CreateInBoundsGEP(palTy, pal, pi));
+      Value* p0 = B.CreateAdd(rowBase, B.CreateMul(gx, cCELL));
+      for (int px = 0; px < n; ++px)
+        B.CreateStore(color, B.CreateInBoundsGEP(i32, fb, B.CreateAdd(p0, ConstantInt::get(i32, px))));
+    };
+    auto *RxI=BasicBlock::Create(C,"render.x.i",fn);
+    auto *RxB=BasicBlock::Create(C,"render.x.b",fn);
+    auto *RxE=BasicBlock::Create(C,"render.x.e",fn);
+    B.CreateBr(RxI);
+
+    B.SetInsertPoint(RxI);
+    auto* gx = B.CreatePHI(i32,2);
+    gx->addIncoming(c0, RyB);
+    B.CreateCondBr(B.CreateICmpSLT(gx, ConstantInt::get(i32, COLS / CELL)), RxB, RxE);
+
+    B.SetInsertPoint(RxB);
+    putCell(gx, CELL);
+    gx->addIncoming(B.CreateAdd(gx, c1), RxB);
+    B.CreateBr(RxI);
+
+    // обрезанная клетка у правого края окна, затем строки 1..CELL-1 - копией первой
+    B.SetInsertPoint(RxE);
+    if (COLS % CELL) putCell(ConstantInt::get(i32, COLS / CELL), COLS % CELL);
+    auto rowsHere = B.CreateSub(ConstantInt::get(i32, SIM_Y_SIZE), py0);
+    rowsHere = B.CreateSelect(B.CreateICmpSLT(rowsHere, cCELL), rowsHere, cCELL);
+    auto* first = B.CreateInBoundsGEP(i32, fb, rowBase);
+    auto *RpI=BasicBlock::Create(C,"render.p.i",fn);
+    auto *RpB=BasicBlock::Create(C,"render.p.b",fn);
+    auto *RpE=BasicBlock::Create(C,"render.p.e",fn);
+    B.CreateBr(RpI);
+
+    B.SetInsertPoint(RpI);
+    auto* py = B.CreatePHI(i32,2);
+    py->addIncoming(c1, RxE);
+    B.CreateCondBr(B.CreateICmpSLT(py, rowsHere), RpB, RpE);
+
+    B.SetInsertPoint(RpB);
+    auto* dst = B.CreateInBoundsGEP(i32, fb, B.CreateAdd(rowBase, B.CreateMul(py, ConstantInt::get(i32, SIM_X_SIZE))));
+    B.CreateMemCpy(dst, MaybeAlign(4), first, MaybeAlign(4), (uint64_t)COLS * 4);
+    py->addIncoming(B.CreateAdd(py, c1), RpB);
+    B.CreateBr(RpI);
+
+    B.SetInsertPoint(RpE);
+    gy->addIncoming(B.CreateAdd(gy, c1), RpE);
+    B.CreateBr(RyI);
+
+    B.SetInsertPoint(RyE);
+    B.CreateRetVoid();
+  }
+
   if (verifyModule(*M, &errs())) { errs()<<"IR verification failed\n"; return 1; }
+  Jit.buildNs = nowNs() - mainStart;
   // M->print(outs(), nullptr);
 
-  std::string err;
-  EngineBuilder EB(std::move(M));
-  EB.setEngineKind(EngineKind::JIT)
-    .setMCJITMemoryManager(std::make_unique<SectionMemoryManager>());
-  auto* EE = EB.setErrorStr(&err).create();
-  if (!EE) { fprintf(stderr,"EE error: %s\n", err.c_str()); return 2; }
-
-  EE->InstallLazyFunctionCreator([](const std::string& n)->void*{
-    if(n=="simPutPixel") return (void*)simPutPixel;
-    if(n=="simFlush")    return (void*)simFlush;
-    if(n=="simRand")     return (void*)simRand;
-    return nullptr;
-  });
-  EE->finalizeObject();
+  // ORC LLLazyJIT: функции модуля компилируются при первом вызове (через
+  // заглушки), компиляция - в пуле из --jit-threads потоков (0 - в вызывающем)
+  const unsigned jitThreads = (unsigned)simOptionInt("jit-threads",
+                                                     std::max(1u, std::thread::hardware_concurrency()));
+  // Машина - хост: имя CPU и его признаки (AVX2, AVX-512...), уровень кодогенерации
+  // по --jit-opt=0..3 (по умолчанию 2)
+  Jit.level = std::min(3, std::max(0, (int)simOptionInt("jit-opt", 2)));
+  Jit.dump = simOption("jit-dump");
+  if (Jit.dump && strcmp(Jit.dump, "ir") != 0 && strcmp(Jit.dump, "asm") != 0) {
+    fprintf(stderr, "app_ir: --jit-dump=ir or --jit-dump=asm\n");
+    return 1;
+  }
+  auto JTMB = orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB) { errs() << "JIT error: " << toString(JTMB.takeError()) << "\n"; return 2; }
+  JTMB->setCPU(sys::getHostCPUName().str());
+  StringMap<bool> hostFeatures;
+  if (sys::getHostCPUFeatures(hostFeatures)) {
+    std::vector<std::string> features;
+    for (auto& f : hostFeatures)
+      features.push_back((f.second ? "+" : "-") + f.first().str());
+    JTMB->addFeatures(features);
+  }
+#if LLVM_VERSION_MAJOR >= 18
+  static const CodeGenOptLevel CodeGenLevels[] = { CodeGenOptLevel::None, CodeGenOptLevel::Less,
+                                                   CodeGenOptLevel::Default, CodeGenOptLevel::Aggressive };
+#else
+  static const CodeGenOpt::Level CodeGenLevels[] = { CodeGenOpt::None, CodeGenOpt::Less,
+                                                     CodeGenOpt::Default, CodeGenOpt::Aggressive };
+#endif
+  JTMB->setCodeGenOptLevel(CodeGenLevels[Jit.level]);
+
+  // Кэш объектов: --jit-cache=dir, по умолчанию $HOME/.cache/app_ir, 0 - выключен
+  if (const char* dir = simOption("jit-cache")) {
+    if (strcmp(dir, "0") != 0) Jit.cacheDir = dir;
+  } else if (const char* home = getenv("HOME")) {
+    Jit.cacheDir = std::string(home) + "/.cache/app_ir";
+  }
+  if (!Jit.cacheDir.empty() && sys::fs::create_directories(Jit.cacheDir)) {
+    fprintf(stderr, "app_ir: cannot create cache directory %s, caching off\n", Jit.cacheDir.c_str());
+    Jit.cacheDir.clear();
+  }
+  fprintf(stderr, "jit: O%d for %s, %u compile threads\n", Jit.level, JTMB->getCPU().c_str(), jitThreads);
+
+  auto J = orc::LLLazyJITBuilder()
+             .setJITTargetMachineBuilder(*JTMB)
+             .setNumCompileThreads(jitThreads)
+             .setCompileFunctionCreator([](orc::JITTargetMachineBuilder B)
+                                          -> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+               return std::make_unique<CachingCompiler>(std::move(B));
+             })
+             .create();
+  if (!J) { errs() << "JIT error: " << toString(J.takeError()) << "\n"; return 2; }
+  atexit(jitReport);
+  auto& JD = (*J)->getMainJITDylib();
+  const DataLayout& DL = (*J)->getDataLayout();
+
+  // Функции sim.c - явной картой адресов (из исполняемого файла они не
+  // экспортируются), остальное (memset/memcpy от оптимизатора) - из процесса
+  orc::MangleAndInterner mangle((*J)->getExecutionSession(), DL);
+  orc::SymbolMap hostSyms;
+  auto host = [&](const char* n, void* p) {
+    const JITSymbolFlags flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+#if LLVM_VERSION_MAJOR >= 17
+    hostSyms[mangle(n)] = { orc::ExecutorAddr::fromPtr(p), flags };
+#else
+    hostSyms[mangle(n)] = JITEvaluatedSymbol(pointerToJITTargetAddress(p), flags);
+#endif
+  };
+  host("simPutPixel",   (void*)simPutPixel);
+  host("simFlush",      (void*)simFlush);
+  host("simRand",       (void*)simRand);
+  host("simFramebuffer", (void*)simFramebuffer);
+  host("simMarkDirty",  (void*)simMarkDirty);
+  host("simParallelFor", (void*)simParallelFor);
+  host("simAddCells",   (void*)simAddCells);
+  host("appRestore",    (void*)appRestore);
+  cantFail(JD.define(orc::absoluteSymbols(std::move(hostSyms))));
+  JD.addGenerator(cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(DL.getGlobalPrefix())));
+
+  if (auto e = (*J)->addLazyIRModule(orc::ThreadSafeModule(std::move(M), std::move(Ctx)))) {
+    errs() << "JIT error: " << toString(std::move(e)) << "\n";
+    return 2;
+  }
+  // Типизированный адрес функции модуля (заглушки: компиляция при первом вызове)
+  auto lookup = [&](const char* n) -> void* {
+    auto sym = (*J)->lookup(n);
+    if (!sym) { errs() << "JIT lookup " << n << ": " << toString(sym.takeError()) << "\n"; exit(2); }
+#if LLVM_VERSION_MAJOR >= 15
+    return sym->toPtr<void*>();
+#else
+    return jitTargetAddressToPointer<void*>(sym->getAddress());
+#endif
+  };
+
+  // Вариант шага: --jit-variant=name или калибровка - каждый вариант коротко
+  // гоняется на ещё пустом поле (до init нули диффундируют в нули, источников
+  // нет, так что состояние не меняется), берётся быстрейший
+  using StepFn = void (*)(int);
+  const long long cells = (long long)W * H;
+  const StepVariant* chosen = nullptr;
+  if (const char* want = simOption("jit-variant")) {
+    for (auto& v : variants)
+      if (v.name == want) chosen = &v;
+    if (!chosen) {
+      fprintf(stderr, "app_ir: unknown --jit-variant=%s (", want);
+      for (auto& v : variants) fprintf(stderr, " %s", v.name.c_str());
+      fprintf(stderr, " )\n");
+      return 1;
+    }
+  } else {
+    const int steps = (int)std::max(1LL, (4LL << 20) / cells);
+    double best = 0;
+    for (auto& v : variants) {
+      auto step = (StepFn)lookup(("step." + v.name).c_str());
+      step(steps);                                // компиляция и прогрев
+      double ns = 0;
+      for (int r = 0; r < 3; ++r) {
+        long long t0 = nowNs();
+        step(steps);
+        double t = (double)(nowNs() - t0) / ((double)cells * steps);
+        if (r == 0 || t < ns) ns = t;
+      }
+      fprintf(stderr, "jit: calibrate step.%s %.3f ns/cell\n", v.name.c_str(), ns);
+      if (!chosen || ns < best) { chosen = &v; best = ns; }
+    }
+  }
+  fprintf(stderr, "jit: %dx%d, cell %d, %d sources, step.%s\n", W, H, CELL, SOURCES, chosen->name.c_str());
+  auto step = (StepFn)lookup(("step." + chosen->name).c_str());
+
+  // --heat-bench: только шаг, строка CSV в колонках SDL/bench.c
+  if (simOptionInt("heat-bench", 0)) {
+    constexpr int OPS_PER_CELL = 10;            // как HEAT_OPS_PER_CELL в bench.c
+    constexpr long long CELL_STEPS = 32LL << 20;
+    auto init = (void (*)())lookup("init");
+    const int reps = std::max(2, (int)simOptionInt("heat-bench-reps", 7));
+    const int steps = (int)std::max(1LL, CELL_STEPS / cells);
+    simSeed(1);
+    init();
+    step(steps);
+    double sum = 0, sum2 = 0, best = 0;
+    for (int r = 0; r < reps; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      step(steps);
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count()
+                  / ((double)cells * steps);
+      sum += ns; sum2 += ns * ns;
+      if (r == 0 || ns < best) best = ns;
+    }
+    const int elem = narrow ? 1 : 4;
+    double mean = sum / reps, var = sum2 / reps - mean * mean;
+    printf("jit,ir-%s,%s,%d,%d,%d,%d,%d,%.4f,%.4f,%.3f,%.3f,%.2f\n", chosen->name.c_str(),
+           narrow ? "u8" : "int", simThreads(), W, H, steps, reps, mean, best, OPS_PER_CELL / mean, 2.0 * elem / mean,
+           100.0 * std::sqrt(var > 0 ? var : 0) / mean);
+    return 0;
+  }
 
+  auto app = (void (*)(StepFn))lookup("app");
   simInit();
-  std::vector<GenericValue> noargs;
-  EE->runFunction(EE->FindFunctionNamed("app"), noargs);
+  app(step);
   simExit();
   return 0;
 }
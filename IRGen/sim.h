@@ -3,9 +3,53 @@
 
 #ifndef __sim__
 void simInit();
+/* Параметры запуска: ключ --name=value (argv из simArgs) или переменная
+   окружения NAME (в верхнем регистре, '-' -> '_'), например --heat-w / HEAT_W */
+void simArgs(int argc, char **argv);
+const char *simOption(const char *name);
+long long simOptionInt(const char *name, long long def);
 void app();
 void simExit();
 void simFlush();
 void simPutPixel(int x, int y, int argb);
+/* Пакетные варианты simPutPixel: один вызов вместо строки / прямоугольника / кадра */
+void simPutSpan(int x, int y, int n, const int *argb);
+void simFillRect(int x, int y, int w, int h, int argb);
+void simBlitCells(const int *cells, int w, int h, int stride, const int *palette, int scale);
+void simBlitCells8(const unsigned char *cells, int w, int h, int stride, const int *palette, int scale);
+/* Прямой доступ к кадру: SIM_Y_SIZE строк по SIM_X_SIZE пикселей ARGB8888.
+   Выгружается только то, что отмечено simMarkDirty (функции выше отмечают сами) */
+int *simFramebuffer();
+void simMarkDirty(int x, int y, int w, int h);
 int simRand();
+/* simRand: xoshiro256**, 0..2^31-1; у каждого потока свой независимый поток чисел */
+void simSeed(unsigned long long seed);
+void simRandStream(unsigned stream);
+void simRandFill(int *out, int n);
+/* Сколько ячеек сетки обновлено в текущем кадре (для телеметрии logical cells/s):
+   логически, w * h * шагов, даже если часть клеток пропущена как заведомо нулевая */
+void simAddCells(long long n);
+/* fn(b, e) по кускам [begin, end) длиной grain в пуле из SIM_THREADS потоков
+   (0 - все ядра, по умолчанию 1); возврат - когда готовы все куски. Куски
+   должны быть независимы, fn не вызывает simParallelFor */
+void simParallelFor(void (*fn)(int begin, int end), int begin, int end, int grain);
+/* Размер этого пула (создаёт его при первом вызове) */
+int simThreads();
+
+/* Снимок состояния: поле температуры (h строк по stride клеток по elem байт),
+   источники sx, sy, svx, svy, sr, st, номер кадра и состояние simRand потока.
+   simSnapshotSave копирует всё и пишет файл в фоне (-1 - прошлый снимок ещё
+   пишется, этот пропущен). simSnapshotLoad отображает файл (MAP_PRIVATE):
+   field и src указывают прямо в отображение; simRand продолжается с момента
+   снимка. Ошибки - сообщение и выход */
+typedef struct
+{
+    int w, h, stride, elem;
+    int sources;
+    long long frame;
+    void *field;
+    int *src[6];
+} SimSnapshot;
+int simSnapshotSave(const char *path, const SimSnapshot *s);
+void simSnapshotLoad(const char *path, SimSnapshot *s);
 #endif
@@ -1,30 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "sim.h"
+#include "heat.h"
 
 void app(void) {
-  /* --- Константы компиляции (всё целое) --- */
-  #define CELL 3                         /* коэрсинг: больше => меньше памяти на стеке */
-  #define W   (SIM_X_SIZE / CELL)        /* ширина расчётной сетки */
-  #define H   (SIM_Y_SIZE / CELL)        /* высота расчётной сетки */
-  #define STEPS_PER_FRAME 4              /* «скорость времени» */
-  #define SOURCES 4                      /* число шаров-источников */
+  /* --- Снимки: --heat-restore=path продолжает с сохранённого состояния (размеры
+         сетки и число источников берутся из него), --heat-snapshot=path пишет
+         снимок каждые --heat-snapshot-every кадров (по умолчанию 100) --- */
+  SimSnapshot snap = { 0 };
+  const char *restore = simOption("heat-restore");
+  if (restore && *restore)
+    simSnapshotLoad(restore, &snap);
+  const char *snapshot = simOption("heat-snapshot");
+  const long long SNAPSHOT_EVERY = simOptionInt("heat-snapshot-every", 100);
+
+  /* --- Параметры запуска: --heat-w=N или HEAT_W=N и т.д. (см. simOption) --- */
+  const int CELL = (int)simOptionInt("heat-cell", 3);        /* пикселей на ячейку */
+  const int W = (int)simOptionInt("heat-w", snap.field ? snap.w : SIM_X_SIZE / CELL); /* ширина сетки */
+  const int H = (int)simOptionInt("heat-h", snap.field ? snap.h : SIM_Y_SIZE / CELL); /* высота сетки */
+  const int STEPS_PER_FRAME = (int)simOptionInt("heat-steps", 4); /* «скорость времени» */
+  const int SOURCES = (int)simOptionInt("heat-sources", snap.field ? snap.sources : 4); /* шаров-источников */
   #define COOLING 1                      /* целочислительное охлаждение на шаг */
   /* alpha = 1/4 реализуем через сдвиг вправо на 2 бита: (lap >> 2) */
+  if (CELL < 1 || W < 3 || H < 3 || STEPS_PER_FRAME < 1 || SOURCES < 0) {
+    fprintf(stderr, "app: bad grid %dx%d (cell %d, steps %d, sources %d)\n",
+            W, H, CELL, STEPS_PER_FRAME, SOURCES);
+    exit(1);
+  }
+  if (snap.field && (W != snap.w || H != snap.h || SOURCES != snap.sources)) {
+    fprintf(stderr, "app: snapshot %s is %dx%d with %d sources\n", restore, snap.w, snap.h, snap.sources);
+    exit(1);
+  }
 
-  /* --- Поля температуры (двойной буфер), всё на стеке --- */
-  int U[2][H][W];
-  int ping = 0, pong = 1;
+  /* --- Хранение клеток: температура всегда в 0..255, поэтому --heat-storage=u8
+         (HEAT_STORAGE=u8) даёт тот же результат бит в бит при вчетверо меньшем
+         трафике памяти; по умолчанию int --- */
+  const char *storage = simOption("heat-storage");
+  const int elem = storage && strcmp(storage, "u8") == 0 ? 1 : (int)sizeof(int);
+  if (storage && *storage && strcmp(storage, "u8") != 0 && strcmp(storage, "int") != 0) {
+    fprintf(stderr, "app: unknown storage '%s' (u8 or int)\n", storage);
+    exit(1);
+  }
 
-  /* Инициализация нулями */
-  for (int y = 0; y < H; ++y)
-    for (int x = 0; x < W; ++x)
-      U[ping][y][x] = 0;
+  /* --- Поля температуры (двойной буфер) и источники - в одной арене;
+         строка дополнена до stride, память из mmap уже обнулена --- */
+  const int stride = heatStride(W, elem);
+  const size_t field = (size_t)stride * H * elem;
+  const size_t srcBytes = (size_t)SOURCES * sizeof(int);
+  HeatArena arena;
+  /* 2 поля + 6 массивов источников + 6 случайных чисел на источник */
+  if (heatArenaInit(&arena, 2 * field + 12 * srcBytes + 9 * 64) != 0)
+    exit(1);
+  HeatGrid grid = { W, H, stride, elem,
+                    { heatArenaAlloc(&arena, field), heatArenaAlloc(&arena, field) } };
+  int ping = 0;
+  long long frame = snap.frame;
+  if (snap.field && snap.elem == elem && snap.stride == stride) {
+    grid.buf[0] = snap.field;   /* поле прямо из отображения снимка, без чтения файла */
+  } else if (snap.field) {
+    /* другое хранение: переложить, значения в 0..255 в обоих */
+    for (int y = 0; y < H; ++y)
+      for (int x = 0; x < W; ++x) {
+        size_t from = (size_t)y * snap.stride + x, to = (size_t)y * stride + x;
+        int t = snap.elem == 1 ? ((unsigned char *)snap.field)[from] : ((int *)snap.field)[from];
+        if (elem == 1)
+          ((unsigned char *)grid.buf[0])[to] = (unsigned char)t;
+        else
+          ((int *)grid.buf[0])[to] = t;
+      }
+  }
 
-  /* --- Источники (позиции, скорости, радиусы, температуры) --- */
-  int sx[SOURCES], sy[SOURCES], svx[SOURCES], svy[SOURCES], sr[SOURCES], st[SOURCES];
+  /* --- Палитра: температура 0..255 -> (r, g=r/2, b=255-r) --- */
+  int palette[256];
+  for (int T = 0; T < 256; ++T)
+    palette[T] = (255 << 24) | (T << 16) | ((T >> 1) << 8) | (255 - T);
 
-  for (int i = 0; i < SOURCES; ++i) {
-    sr[i] = 4 + (simRand() % 9);                 /* 4..12 */
-    st[i] = 176 + (simRand() & 63);              /* 176..239 */
+  /* --- Источники (позиции, скорости, радиусы, температуры) --- */
+  int *sx = heatArenaAlloc(&arena, srcBytes), *sy = heatArenaAlloc(&arena, srcBytes);
+  int *svx = heatArenaAlloc(&arena, srcBytes), *svy = heatArenaAlloc(&arena, srcBytes);
+  int *sr = heatArenaAlloc(&arena, srcBytes), *st = heatArenaAlloc(&arena, srcBytes);
+
+  int *srcArr[6] = { sx, sy, svx, svy, sr, st };
+
+  /* случайные числа берутся одним пакетом, в том же порядке, что и поштучно */
+  int *rnd = heatArenaAlloc(&arena, srcBytes * 6);
+  if (snap.field)
+    for (int k = 0; k < 6; ++k)
+      memcpy(srcArr[k], snap.src[k], srcBytes);
+  else
+    simRandFill(rnd, SOURCES * 6);
+  for (int i = 0; i < SOURCES && !snap.field; ++i) {
+    const int *ri = rnd + 6 * i;
+    sr[i] = 4 + (ri[0] % 9);                     /* 4..12 */
+    st[i] = 176 + (ri[1] & 63);                  /* 176..239 */
 
     int xmin = 1 + sr[i];
     int xmax = (W - 2) - sr[i];
@@ -33,14 +102,18 @@ void app(void) {
     if (xmax < xmin) { xmin = 1; xmax = W - 2; } /* на случай очень мелкой сетки */
     if (ymax < ymin) { ymin = 1; ymax = H - 2; }
 
-    sx[i] = xmin + (simRand() % (xmax - xmin + 1));
-    sy[i] = ymin + (simRand() % (ymax - ymin + 1));
+    sx[i] = xmin + (ri[2] % (xmax - xmin + 1));
+    sy[i] = ymin + (ri[3] % (ymax - ymin + 1));
 
     /* постоянная скорость: по каждой оси ±1 (без нулей) */
-    svx[i] = (simRand() & 1) ? 1 : -1;
-    svy[i] = (simRand() & 1) ? 1 : -1;
+    svx[i] = (ri[4] & 1) ? 1 : -1;
+    svy[i] = (ri[5] & 1) ? 1 : -1;
   }
 
+  HeatSources src = { sx, sy, sr, st, SOURCES, NULL };
+  HeatView view;
+  heatViewInit(&view, &grid, CELL, palette);
+
   /* --- Главный цикл --- */
   while (1) {
     /* движение и отскоки (учитываем радиус) */
@@ -60,69 +133,19 @@ void app(void) {
       else if (sy[i] >= ymax) { sy[i] = ymax; svy[i] = -svy[i]; }
     }
 
-    /* несколько шагов явной схемы на кадр */
-    for (int s = 0; s < STEPS_PER_FRAME; ++s) {
-      int (*cur)[W]  = U[ping];
-      int (*next)[W] = U[pong];
-
-      /* подогрев: диски в текущих позициях */
-      for (int i = 0; i < SOURCES; ++i) {
-        int cx = sx[i], cy = sy[i], r = sr[i], r2 = r * r;
-        int y0 = cy - r; if (y0 < 1) y0 = 1;
-        int y1 = cy + r; if (y1 > H - 2) y1 = H - 2;
-        int x0 = cx - r; if (x0 < 1) x0 = 1;
-        int x1 = cx + r; if (x1 > W - 2) x1 = W - 2;
-
-        for (int y = y0; y <= y1; ++y) {
-          int dy = y - cy; int dy2 = dy * dy;
-          for (int x = x0; x <= x1; ++x) {
-            int dx = x - cx;
-            if (dx * dx + dy2 <= r2) {
-              int tt = st[i];
-              if (cur[y][x] < tt) cur[y][x] = tt;
-            }
-          }
-        }
-      }
-
-      /* теплопроводность: u_{n+1} = u + (lap >> 2) - COOLING; края = 0 */
-      for (int y = 1; y < H - 1; ++y) {
-        for (int x = 1; x < W - 1; ++x) {
-          int u   = cur[y][x];
-          int lap = cur[y][x-1] + cur[y][x+1] + cur[y-1][x] + cur[y+1][x] - 4 * u;
-          int un  = u + (lap >> 2) - COOLING;  /* alpha = 1/4 */
-          if (un < 0) un = 0;
-          if (un > 255) un = 255;
-          next[y][x] = un;
-        }
-      }
-      for (int x = 0; x < W; ++x) { next[0][x] = 0; next[H-1][x] = 0; }
-      for (int y = 0; y < H; ++y) { next[y][0] = 0; next[y][W-1] = 0; }
-
-      int t = ping; ping = pong; pong = t;
+    /* несколько шагов явной схемы на кадр: подогрев -> диффузия -> края -> смена
+       буфера; строки делятся между потоками пула (heat_pool.c, HEAT_THREADS) */
+    ping = heatSteps(&grid, ping, &src, STEPS_PER_FRAME, COOLING);
+    simAddCells((long long)W * H * STEPS_PER_FRAME);
+    ++frame;
+    if (snapshot && *snapshot && SNAPSHOT_EVERY > 0 && frame % SNAPSHOT_EVERY == 0) {
+      SimSnapshot now = { W, H, stride, elem, SOURCES, frame, grid.buf[ping],
+                          { sx, sy, svx, svy, sr, st } };
+      simSnapshotSave(snapshot, &now);   /* копия и выход, файл пишется в фоне */
     }
 
-    /* отрисовка: температура 0..255 -> (r, g=r/2, b=255-r) */
-    int (*draw)[W] = U[ping];
-    for (int gy = 0; gy < H; ++gy) {
-      for (int gx = 0; gx < W; ++gx) {
-        int T = draw[gy][gx];
-        if (T < 0) T = 0; if (T > 255) T = 255;
-        int r = T;
-        int g = T >> 1;
-        int b = 255 - T;
-        int color = (255 << 24) | (r << 16) | (g << 8) | b;
-
-        int x0 = gx * CELL, y0 = gy * CELL;
-        for (int py = 0; py < CELL; ++py) {
-          int y = y0 + py; if (y >= SIM_Y_SIZE) break;
-          for (int px = 0; px < CELL; ++px) {
-            int x = x0 + px; if (x >= SIM_X_SIZE) break;
-            simPutPixel(x, y, color);
-          }
-        }
-      }
-    }
+    /* отрисовка: только изменившиеся ячейки, CELL x CELL пикселей на ячейку */
+    heatRender(&view, &grid, ping);
 
     simFlush();
   }
@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sim.h"
+#include "heat.h"
+
+/*
+ * Микробенчмарк шага теплопроводности из app3.c (подогрев -> диффузия ->
+ * края -> смена буфера) по вариантам и размерам сетки, от умещающейся в L1
+ * до упирающейся в DRAM. Каждый вариант x размер считается в отдельном
+ * процессе (fork): ядро, пул и хранение в heat*.c настраиваются переменными
+ * HEAT_* один раз за процесс. Результат - CSV в stdout:
+ *
+ *   variant,kernel,storage,threads,w,h,steps,reps,ns_per_cell,ns_per_cell_min,gops,gbps,cv_pct
+ *
+ * ns_per_cell - среднее по повторам, cv_pct - разброс повторов (stddev/mean),
+ * gops - HEAT_OPS_PER_CELL операций на клетку-шаг, gbps - модельный трафик
+ * 2 * sizeof(клетки) на клетку-шаг (чтение + запись поля).
+ *
+ * Ключи (или переменные окружения, см. simOption):
+ *   --bench-sizes=32,64,...   стороны квадратных сеток
+ *   --bench-variants=scalar,vector,narrow,threaded,tiled,jit
+ *   --bench-reps=N            повторов на точку (по умолчанию 7)
+ *   --bench-jit=PATH          app_ir из IRGen для варианта jit
+ *
+ * --bench-solver=T вместо этого сравнивает явную схему с ADI (heat_adi.c) на
+ * T явных шагах от нулевого поля с неподвижными источниками: время до решения
+ * и ошибка ADI относительно явной схемы (в градусах 0..255), CSV:
+ *
+ *   solver,dt,w,h,time_steps,ms,speedup,rms_err,max_err
+ *
+ *   --bench-adi-dt=4,8,...    длины шагов ADI в явных шагах
+ *
+ * Размеры по умолчанию - 85,256,1024: 85 не кратно 8, на нём проверяется
+ * неполная последняя группа строк прогонки ADI.
+ */
+
+#define HEAT_OPS_PER_CELL 10  /* 3 сложения соседей, 4u, lap, >>2, +u, -cooling, 2 обрезки */
+#define BENCH_CELL_STEPS (32LL << 20) /* клеток-шагов на повтор, не меньше */
+#define BENCH_STEPS_PER_CALL 4        /* как STEPS_PER_FRAME в app3.c */
+
+typedef struct
+{
+    const char *name;
+    const char *env[3]; /* "NAME=value" для setenv в процессе варианта */
+} Variant;
+
+static const Variant Variants[] = {
+    { "scalar", { "HEAT_KERNEL=scalar" } },
+    { "vector", { NULL } },
+    { "narrow", { "HEAT_STORAGE=u8" } },
+    { "threaded", { "HEAT_THREADS=0" } },
+    { "tiled", { "HEAT_TILE=1" } },
+    { "jit", { NULL } },
+};
+
+#define VARIANT_COUNT ((int)(sizeof(Variants) / sizeof(Variants[0])))
+
+static double nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void putEnv(const char *kv)
+{
+    char name[64];
+    const char *eq = strchr(kv, '=');
+    snprintf(name, sizeof(name), "%.*s", (int)(eq - kv), kv);
+    setenv(name, eq + 1, 1);
+}
+
+typedef struct
+{
+    HeatArena arena;
+    HeatGrid grid;
+    HeatSources src;
+} BenchCase;
+
+/* Сетка n x n (клетки по elem байт) с источниками по 4 на 256x256, радиус 8,
+   как в app3.c по плотности; позиции от зерна 1, одинаковые во всех замерах */
+static void benchCase(BenchCase *c, int n, int elem)
+{
+    const int stride = heatStride(n, elem);
+    const size_t field = (size_t)stride * n * elem;
+    int sources = (int)((long long)n * n * 4 / (256 * 256));
+    if (sources < 1)
+        sources = 1;
+    if (heatArenaInit(&c->arena, 2 * field + 4 * (size_t)sources * sizeof(int) + 6 * 64) != 0)
+        exit(1);
+    HeatGrid grid = { n, n, stride, elem, { heatArenaAlloc(&c->arena, field), heatArenaAlloc(&c->arena, field) } };
+    int *sx = heatArenaAlloc(&c->arena, sources * sizeof(int)), *sy = heatArenaAlloc(&c->arena, sources * sizeof(int));
+    int *sr = heatArenaAlloc(&c->arena, sources * sizeof(int)), *st = heatArenaAlloc(&c->arena, sources * sizeof(int));
+    simSeed(1);
+    for (int i = 0; i < sources; ++i)
+    {
+        sr[i] = n >= 32 ? 8 : n / 4;
+        st[i] = 200;
+        sx[i] = 1 + simRand() % (n - 2);
+        sy[i] = 1 + simRand() % (n - 2);
+    }
+    HeatSources src = { sx, sy, sr, st, sources, NULL };
+    c->grid = grid;
+    c->src = src;
+}
+
+/* В процессе варианта: n x n, несколько холостых шагов, затем reps замеров */
+static void runVariant(const Variant *v, int n, int reps)
+{
+    for (int k = 0; k < 3 && v->env[k]; ++k)
+        putEnv(v->env[k]);
+    const char *storage = simOption("heat-storage");
+    const int elem = storage && strcmp(storage, "u8") == 0 ? 1 : (int)sizeof(int);
+    BenchCase bc;
+    benchCase(&bc, n, elem);
+
+    long long cells = (long long)n * n;
+    int calls = (int)((BENCH_CELL_STEPS / cells + BENCH_STEPS_PER_CALL - 1) / BENCH_STEPS_PER_CALL);
+    if (calls < 1)
+        calls = 1;
+    int ping = 0;
+    for (int c = 0; c < calls; ++c)
+        ping = heatSteps(&bc.grid, ping, &bc.src, BENCH_STEPS_PER_CALL, 1);
+
+    double sum = 0, sum2 = 0, best = 0;
+    for (int r = 0; r < reps; ++r)
+    {
+        double t0 = nowNs();
+        for (int c = 0; c < calls; ++c)
+            ping = heatSteps(&bc.grid, ping, &bc.src, BENCH_STEPS_PER_CALL, 1);
+        double ns = (nowNs() - t0) / ((double)cells * calls * BENCH_STEPS_PER_CALL);
+        sum += ns;
+        sum2 += ns * ns;
+        if (r == 0 || ns < best)
+            best = ns;
+    }
+    double mean = sum / reps;
+    double var = sum2 / reps - mean * mean;
+    printf("%s,%s,%s,%d,%d,%d,%d,%d,%.4f,%.4f,%.3f,%.3f,%.2f\n", v->name, heatKernelName(),
+           elem == 1 ? "u8" : "int", heatThreads(), n, n, calls * BENCH_STEPS_PER_CALL, reps, mean, best,
+           HEAT_OPS_PER_CELL / mean, 2.0 * elem / mean, 100.0 * sqrt(var > 0 ? var : 0) / mean);
+    fflush(stdout);
+}
+
+/* В процессе размера: явная схема (эталон), затем ADI с каждым dt из списка */
+static void runSolvers(int n, int steps, const char *dts)
+{
+    BenchCase ref;
+    benchCase(&ref, n, (int)sizeof(int));
+    double t0 = nowNs();
+    int refPing = heatSteps(&ref.grid, 0, &ref.src, steps, 1);
+    double refMs = (nowNs() - t0) / 1e6;
+    const int *want = ref.grid.buf[refPing];
+    printf("explicit,1,%d,%d,%d,%.3f,1.00,0.000,0\n", n, n, steps, refMs);
+    fflush(stdout);
+
+    for (const char *p = dts; *p; )
+    {
+        int dt = atoi(p);
+        p += strcspn(p, ",");
+        p += *p == ',';
+        if (dt < 1)
+            continue;
+        heatAdiSetDt(dt);
+        BenchCase adi;
+        benchCase(&adi, n, (int)sizeof(int));
+        t0 = nowNs();
+        int ping = heatAdiSteps(&adi.grid, 0, &adi.src, steps, 1);
+        double ms = (nowNs() - t0) / 1e6;
+        const int *got = adi.grid.buf[ping];
+        double sum2 = 0;
+        int worst = 0;
+        for (int y = 0; y < n; ++y)
+            for (int x = 0; x < n; ++x)
+            {
+                int d = got[(size_t)y * adi.grid.stride + x] - want[(size_t)y * ref.grid.stride + x];
+                sum2 += (double)d * d;
+                if (abs(d) > worst)
+                    worst = abs(d);
+            }
+        printf("adi,%d,%d,%d,%d,%.3f,%.2f,%.3f,%d\n", dt, n, n, steps, ms, refMs / ms,
+               sqrt(sum2 / ((double)n * n)), worst);
+        fflush(stdout);
+    }
+}
+
+static int selected(const char *list, const char *name)
+{
+    if (!list || !*list)
+        return 1;
+    size_t len = strlen(name);
+    for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+    return 0;
+}
+
+static void waitChild(pid_t pid, const char *what)
+{
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fprintf(stderr, "bench: %s failed\n", what);
+}
+
+int main(int argc, char **argv)
+{
+    simArgs(argc, argv);
+    const char *sizes = simOption("bench-sizes");
+    const char *variants = simOption("bench-variants");
+    const char *jit = simOption("bench-jit");
+    int reps = (int)simOptionInt("bench-reps", 7);
+    if (!sizes || !*sizes)
+        sizes = "32,64,128,256,512,1024,2048,4096";
+    if (reps < 2)
+        reps = 2;
+
+    const int solverSteps = (int)simOptionInt("bench-solver", 0);
+    if (solverSteps > 0)
+    {
+        const char *dts = simOption("bench-adi-dt");
+        if (!dts || !*dts)
+            dts = "4,8,16,32,64";
+        if (!simOption("bench-sizes"))
+            sizes = "85,256,1024";
+        printf("solver,dt,w,h,time_steps,ms,speedup,rms_err,max_err\n");
+        fflush(stdout);
+        for (const char *p = sizes; *p; )
+        {
+            int n = atoi(p);
+            if (n >= 3)
+            {
+                pid_t pid = fork();
+                if (pid == 0)
+                {
+                    runSolvers(n, solverSteps, dts);
+                    _exit(0);
+                }
+                waitChild(pid, "solver");
+            }
+            p += strcspn(p, ",");
+            p += *p == ',';
+        }
+        return 0;
+    }
+
+    printf("variant,kernel,storage,threads,w,h,steps,reps,ns_per_cell,ns_per_cell_min,gops,gbps,cv_pct\n");
+    fflush(stdout);
+    for (int k = 0; k < VARIANT_COUNT; ++k)
+    {
+        const Variant *v = &Variants[k];
+        if (!selected(variants, v->name))
+            continue;
+        if (strcmp(v->name, "jit") == 0)
+        {
+            /* IR-версия шага: app_ir --heat-bench печатает строку в тех же колонках */
+            if (!jit || !*jit)
+            {
+                if (variants && *variants)
+                    fprintf(stderr, "bench: jit needs --bench-jit=path/to/app_ir\n");
+                continue;
+            }
+            for (const char *p = sizes; *p; )
+            {
+                int n = atoi(p);
+                if (n >= 3)
+                {
+                    char arg[64], w[32], h[32];
+                    snprintf(arg, sizeof(arg), "--heat-bench-reps=%d", reps);
+                    snprintf(w, sizeof(w), "--heat-w=%d", n);
+                    snprintf(h, sizeof(h), "--heat-h=%d", n);
+                    pid_t pid = fork();
+                    if (pid == 0)
+                    {
+                        execl(jit, jit, "--heat-bench=1", arg, w, h, (char *)NULL);
+                        perror("bench: exec jit");
+                        _exit(1);
+                    }
+                    waitChild(pid, "jit");
+                }
+                p += strcspn(p, ",");
+                p += *p == ',';
+            }
+            continue;
+        }
+        for (const char *p = sizes; *p; )
+        {
+            int n = atoi(p);
+            if (n >= 3)
+            {
+                pid_t pid = fork();
+                if (pid == 0)
+                {
+                    runVariant(v, n, reps);
+                    _exit(0);
+                }
+                waitChild(pid, v->name);
+            }
+            p += strcspn(p, ",");
+            p += *p == ',';
+        }
+    }
+    return 0;
+}
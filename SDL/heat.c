@@ -0,0 +1,684 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "heat.h"
+#include "sim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEAT_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Векторные строки собираются атрибутом target, поэтому heat.c не требует
+ * -mavx2 и т.п.: нужная версия выбирается при первом вызове по cpuid.
+ * HEAT_KERNEL=scalar|sse41|avx2|avx512 задаёт её явно, HEAT_VALIDATE=1
+ * сверяет каждый шаг со скалярной версией.
+ */
+
+#define HUGE_PAGE (2u << 20)
+
+int heatArenaInit(HeatArena *a, size_t bytes)
+{
+    size_t size = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        perror("heat: arena mmap");
+        return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+    a->base = p;
+    a->size = size;
+    a->used = 0;
+    return 0;
+}
+
+void *heatArenaAlloc(HeatArena *a, size_t bytes)
+{
+    size_t at = (a->used + 63) & ~(size_t)63;
+    if (at + bytes > a->size)
+        return NULL;
+    a->used = at + bytes;
+    return a->base + at;
+}
+
+int heatStride(int w, int elem)
+{
+    size_t bytes = ((size_t)w * elem + 63) & ~(size_t)63;
+    if (bytes % 4096 == 0)
+        bytes += 64;
+    return (int)(bytes / elem);
+}
+
+/* Скалярный расчёт клеток [x0, x1) строки; им же добиваются хвосты векторных строк */
+static inline void rowRange(const int *up, const int *mid, const int *dn, int *out,
+                            int x0, int x1, int cooling)
+{
+    for (int x = x0; x < x1; ++x)
+    {
+        int u   = mid[x];
+        int lap = mid[x - 1] + mid[x + 1] + up[x] + dn[x] - 4 * u;
+        int un  = u + (lap >> 2) - cooling;
+        if (un < 0) un = 0;
+        if (un > 255) un = 255;
+        out[x] = un;
+    }
+}
+
+static inline void rowRange8(const uint8_t *up, const uint8_t *mid, const uint8_t *dn,
+                             uint8_t *out, int x0, int x1, int cooling)
+{
+    for (int x = x0; x < x1; ++x)
+    {
+        int u   = mid[x];
+        int lap = mid[x - 1] + mid[x + 1] + up[x] + dn[x] - 4 * u;
+        int un  = u + (lap >> 2) - cooling;
+        if (un < 0) un = 0;
+        if (un > 255) un = 255;
+        out[x] = (uint8_t)un;
+    }
+}
+
+static void rowScalar(const void *up, const void *mid, const void *dn, void *out,
+                      int w, int cooling)
+{
+    int *o = out;
+    rowRange(up, mid, dn, o, 1, w - 1, cooling);
+    o[0] = 0;
+    o[w - 1] = 0;
+}
+
+static void rowScalar8(const void *up, const void *mid, const void *dn, void *out,
+                       int w, int cooling)
+{
+    uint8_t *o = out;
+    rowRange8(up, mid, dn, o, 1, w - 1, cooling);
+    o[0] = 0;
+    o[w - 1] = 0;
+}
+
+#ifdef HEAT_X86
+__attribute__((target("sse4.1")))
+static void rowSse41(const void *vup, const void *vmid, const void *vdn, void *vout,
+                     int w, int cooling)
+{
+    const int *up = vup, *mid = vmid, *dn = vdn;
+    int *out = vout;
+    const __m128i vc = _mm_set1_epi32(cooling);
+    const __m128i lo = _mm_setzero_si128();
+    const __m128i hi = _mm_set1_epi32(255);
+    int x = 1;
+    for (; x + 4 <= w - 1; x += 4)
+    {
+        __m128i c   = _mm_loadu_si128((const __m128i *)(mid + x));
+        __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *)(mid + x - 1)),
+                                                  _mm_loadu_si128((const __m128i *)(mid + x + 1))),
+                                    _mm_add_epi32(_mm_loadu_si128((const __m128i *)(up + x)),
+                                                  _mm_loadu_si128((const __m128i *)(dn + x))));
+        __m128i lap = _mm_sub_epi32(sum, _mm_slli_epi32(c, 2));
+        __m128i un  = _mm_sub_epi32(_mm_add_epi32(c, _mm_srai_epi32(lap, 2)), vc);
+        _mm_storeu_si128((__m128i *)(out + x), _mm_min_epi32(_mm_max_epi32(un, lo), hi));
+    }
+    rowRange(up, mid, dn, out, x, w - 1, cooling);
+    out[0] = 0;
+    out[w - 1] = 0;
+}
+
+/* 8-битные строки: расширение до i16 (|lap| <= 1020 помещается), сужение
+   packus/cvtus с насыщением - это и есть обрезка до 0..255 */
+__attribute__((target("sse4.1")))
+static void rowSse41_8(const void *vup, const void *vmid, const void *vdn, void *vout,
+                       int w, int cooling)
+{
+    const uint8_t *up = vup, *mid = vmid, *dn = vdn;
+    uint8_t *out = vout;
+    const __m128i vc = _mm_set1_epi16((short)cooling);
+    int x = 1;
+    for (; x + 16 <= w - 1; x += 16)
+    {
+        __m128i r[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            int o = x + 8 * half;
+            __m128i c   = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(mid + o)));
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(mid + o - 1))),
+                                                      _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(mid + o + 1)))),
+                                        _mm_add_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(up + o))),
+                                                      _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(dn + o)))));
+            __m128i lap = _mm_sub_epi16(sum, _mm_slli_epi16(c, 2));
+            r[half] = _mm_sub_epi16(_mm_add_epi16(c, _mm_srai_epi16(lap, 2)), vc);
+        }
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(r[0], r[1]));
+    }
+    rowRange8(up, mid, dn, out, x, w - 1, cooling);
+    out[0] = 0;
+    out[w - 1] = 0;
+}
+
+__attribute__((target("avx2")))
+static void rowAvx2(const void *vup, const void *vmid, const void *vdn, void *vout,
+                    int w, int cooling)
+{
+    const int *up = vup, *mid = vmid, *dn = vdn;
+    int *out = vout;
+    const __m256i vc = _mm256_set1_epi32(cooling);
+    const __m256i lo = _mm256_setzero_si256();
+    const __m256i hi = _mm256_set1_epi32(255);
+    int x = 1;
+    for (; x + 8 <= w - 1; x += 8)
+    {
+        __m256i c   = _mm256_loadu_si256((const __m256i *)(mid + x));
+        __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(mid + x - 1)),
+                                                        _mm256_loadu_si256((const __m256i *)(mid + x + 1))),
+                                       _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(up + x)),
+                                                        _mm256_loadu_si256((const __m256i *)(dn + x))));
+        __m256i lap = _mm256_sub_epi32(sum, _mm256_slli_epi32(c, 2));
+        __m256i un  = _mm256_sub_epi32(_mm256_add_epi32(c, _mm256_srai_epi32(lap, 2)), vc);
+        _mm256_storeu_si256((__m256i *)(out + x), _mm256_min_epi32(_mm256_max_epi32(un, lo), hi));
+    }
+    rowRange(up, mid, dn, out, x, w - 1, cooling);
+    out[0] = 0;
+    out[w - 1] = 0;
+}
+
+__attribute__((target("avx2")))
+static void rowAvx2_8(const void *vup, const void *vmid, const void *vdn, void *vout,
+                      int w, int cooling)
+{
+    const uint8_t *up = vup, *mid = vmid, *dn = vdn;
+    uint8_t *out = vout;
+    const __m256i vc = _mm256_set1_epi16((short)cooling);
+    int x = 1;
+    for (; x + 32 <= w - 1; x += 32)
+    {
+        __m256i r[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            int o = x + 16 * half;
+            __m256i c   = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(mid + o)));
+            __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(mid + o - 1))),
+                                                            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(mid + o + 1)))),
+                                           _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(up + o))),
+                                                            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(dn + o)))));
+            __m256i lap = _mm256_sub_epi16(sum, _mm256_slli_epi16(c, 2));
+            r[half] = _mm256_sub_epi16(_mm256_add_epi16(c, _mm256_srai_epi16(lap, 2)), vc);
+        }
+        /* packus работает по 128-битным половинам - возвращаем порядок перестановкой */
+        __m256i packed = _mm256_packus_epi16(r[0], r[1]);
+        _mm256_storeu_si256((__m256i *)(out + x), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    rowRange8(up, mid, dn, out, x, w - 1, cooling);
+    out[0] = 0;
+    out[w - 1] = 0;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void rowAvx512(const void *vup, const void *vmid, const void *vdn, void *vout,
+                      int w, int cooling)
+{
+    const int *up = vup, *mid = vmid, *dn = vdn;
+    int *out = vout;
+    const __m512i vc = _mm512_set1_epi32(cooling);
+    const __m512i lo = _mm512_setzero_si512();
+    const __m512i hi = _mm512_set1_epi32(255);
+    int x = 1;
+    for (; x + 16 <= w - 1; x += 16)
+    {
+        __m512i c   = _mm512_loadu_si512(mid + x);
+        __m512i sum = _mm512_add_epi32(_mm512_add_epi32(_mm512_loadu_si512(mid + x - 1),
+                                                        _mm512_loadu_si512(mid + x + 1)),
+                                       _mm512_add_epi32(_mm512_loadu_si512(up + x),
+                                                        _mm512_loadu_si512(dn + x)));
+        __m512i lap = _mm512_sub_epi32(sum, _mm512_slli_epi32(c, 2));
+        __m512i un  = _mm512_sub_epi32(_mm512_add_epi32(c, _mm512_srai_epi32(lap, 2)), vc);
+        _mm512_storeu_si512(out + x, _mm512_min_epi32(_mm512_max_epi32(un, lo), hi));
+    }
+    rowRange(up, mid, dn, out, x, w - 1, cooling);
+    out[0] = 0;
+    out[w - 1] = 0;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void rowAvx512_8(const void *vup, const void *vmid, const void *vdn, void *vout,
+                        int w, int cooling)
+{
+    const uint8_t *up = vup, *mid = vmid, *dn = vdn;
+    uint8_t *out = vout;
+    const __m512i vc = _mm512_set1_epi16((short)cooling);
+    const __m512i lo = _mm512_setzero_si512();
+    int x = 1;
+    for (; x + 32 <= w - 1; x += 32)
+    {
+        __m512i c   = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(mid + x)));
+        __m512i sum = _mm512_add_epi16(_mm512_add_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(mid + x - 1))),
+                                                        _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(mid + x + 1)))),
+                                       _mm512_add_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(up + x))),
+                                                        _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(dn + x)))));
+        __m512i lap = _mm512_sub_epi16(sum, _mm512_slli_epi16(c, 2));
+        __m512i un  = _mm512_sub_epi16(_mm512_add_epi16(c, _mm512_srai_epi16(lap, 2)), vc);
+        /* после max(0) значения 0..510, беззнаковое насыщение даёт обрезку до 255 */
+        _mm256_storeu_si256((__m256i *)(out + x), _mm512_cvtusepi16_epi8(_mm512_max_epi16(un, lo)));
+    }
+    rowRange8(up, mid, dn, out, x, w - 1, cooling);
+    out[0] = 0;
+    out[w - 1] = 0;
+}
+#endif
+
+static const struct
+{
+    const char *name;
+    HeatRowFn fn;   /* клетки int */
+    HeatRowFn fn8;  /* клетки uint8_t */
+} Kernels[] = {
+#ifdef HEAT_X86
+    { "avx512", rowAvx512, rowAvx512_8 },
+    { "avx2", rowAvx2, rowAvx2_8 },
+    { "sse41", rowSse41, rowSse41_8 },
+#endif
+    { "scalar", rowScalar, rowScalar8 },
+};
+
+#define KERNEL_COUNT ((int)(sizeof(Kernels) / sizeof(Kernels[0])))
+
+static int Kernel = -1;
+static int Validate = 0;
+
+static int kernelSupported(int k)
+{
+#ifdef HEAT_X86
+    __builtin_cpu_init();
+    if (Kernels[k].fn == rowAvx512)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    if (Kernels[k].fn == rowAvx2)   return __builtin_cpu_supports("avx2");
+    if (Kernels[k].fn == rowSse41)  return __builtin_cpu_supports("sse4.1");
+#endif
+    return 1;
+}
+
+static void selectKernel(void)
+{
+    const char *want = simOption("heat-kernel");
+    const char *v = simOption("heat-validate");
+    Validate = v && *v && strcmp(v, "0") != 0;
+    for (int k = 0; k < KERNEL_COUNT; ++k)
+    {
+        if (want && *want && strcmp(want, Kernels[k].name) != 0)
+            continue;
+        if (!kernelSupported(k))
+        {
+            if (want && *want)
+                fprintf(stderr, "heat: kernel '%s' is not supported by this CPU\n", want);
+            continue;
+        }
+        Kernel = k;
+        fprintf(stderr, "heat: %s kernel%s\n", Kernels[k].name, Validate ? " (validated)" : "");
+        return;
+    }
+    if (want && *want)
+        fprintf(stderr, "heat: unknown kernel '%s', using scalar\n", want);
+    Kernel = KERNEL_COUNT - 1;
+}
+
+const char *heatKernelName(void)
+{
+    if (Kernel < 0)
+        selectKernel();
+    return Kernels[Kernel].name;
+}
+
+static HeatRowFn rowFn(int elem)
+{
+    if (Kernel < 0)
+        selectKernel();
+    return elem == 1 ? Kernels[Kernel].fn8 : Kernels[Kernel].fn;
+}
+
+static void validateRow(const void *up, const void *mid, const void *dn, const void *out,
+                        int w, int elem, int cooling, int y)
+{
+    static _Thread_local char *ref = NULL;
+    static _Thread_local size_t refSize = 0;
+    size_t bytes = (size_t)w * elem;
+    if (refSize < bytes)
+    {
+        free(ref);
+        ref = malloc(bytes);
+        refSize = bytes;
+    }
+    (elem == 1 ? rowScalar8 : rowScalar)(up, mid, dn, ref, w, cooling);
+    if (memcmp(ref, out, bytes) != 0)
+    {
+        fprintf(stderr, "heat: kernel '%s' differs from scalar in row %d\n",
+                Kernels[Kernel].name, y);
+        abort();
+    }
+}
+
+void heatDiffuseRows(const HeatGrid *g, int ping, int cooling, int y0, int y1)
+{
+    HeatRowFn row = rowFn(g->elem);
+    const size_t pitch = (size_t)g->stride * g->elem, bytes = (size_t)g->w * g->elem;
+    const char *cur = g->buf[ping];
+    char *next = g->buf[ping ^ 1];
+    for (int y = y0; y < y1; ++y)
+    {
+        char *out = next + y * pitch;
+        if (y == 0 || y == g->h - 1)
+        {
+            memset(out, 0, bytes);
+            continue;
+        }
+        const char *mid = cur + y * pitch;
+        row(mid - pitch, mid, mid + pitch, out, g->w, cooling);
+        if (Validate)
+            validateRow(mid - pitch, mid, mid + pitch, out, g->w, g->elem, cooling, y);
+    }
+}
+
+static int anyNonZero(const unsigned char *p, size_t n)
+{
+    unsigned char acc = 0;
+    for (size_t i = 0; i < n; ++i)
+        acc |= p[i];
+    return acc != 0;
+}
+
+int heatDiffuseRect(const HeatGrid *g, int ping, int cooling, int x0, int x1, int y0, int y1)
+{
+    static _Thread_local char *line = NULL;
+    static _Thread_local size_t lineSize = 0;
+    HeatRowFn row = rowFn(g->elem);
+    const int w = g->w, h = g->h, elem = g->elem;
+    const size_t pitch = (size_t)g->stride * elem;
+    const char *cur = g->buf[ping];
+    char *next = g->buf[ping ^ 1];
+    int cx0 = x0 > 1 ? x0 : 1, cx1 = x1 < w - 1 ? x1 : w - 1;
+    size_t bytes = (size_t)(cx1 - cx0 + 2) * elem;
+    if (lineSize < bytes)
+    {
+        free(line);
+        line = malloc(bytes);
+        lineSize = bytes;
+    }
+
+    int any = 0;
+    for (int y = y0; y < y1; ++y)
+    {
+        char *out = next + y * pitch;
+        if (y == 0 || y == h - 1 || cx0 >= cx1)
+        {
+            memset(out + (size_t)x0 * elem, 0, (size_t)(x1 - x0) * elem);
+            continue;
+        }
+        /* строка считается в буфер потока: её края (cx0-1, cx1) принадлежат
+           соседним прямоугольникам и в сетку не копируются */
+        const char *mid = cur + y * pitch + (size_t)(cx0 - 1) * elem;
+        row(mid - pitch, mid, mid + pitch, line, cx1 - cx0 + 2, cooling);
+        if (Validate)
+            validateRow(mid - pitch, mid, mid + pitch, line, cx1 - cx0 + 2, elem, cooling, y);
+        memcpy(out + (size_t)cx0 * elem, line + elem, (size_t)(cx1 - cx0) * elem);
+        if (x0 == 0)
+            memset(out, 0, elem);
+        if (x1 == w)
+            memset(out + (size_t)(w - 1) * elem, 0, elem);
+        any |= anyNonZero((const unsigned char *)line + elem, (size_t)(cx1 - cx0) * elem);
+    }
+    return any;
+}
+
+/* Полуширины дисков: Spans[r*(r+1)/2 + |dy|] - наибольший dx, при котором
+   dx*dx + dy*dy <= r*r. Растёт только в heatBinSources (поток 0) или при
+   подогреве без корзин из одного потока */
+static int *Spans = NULL;
+static int SpansMax = -1;
+
+static void reserveSpans(int rmax)
+{
+    if (rmax <= SpansMax)
+        return;
+    int *t = realloc(Spans, sizeof(int) * (size_t)(rmax + 1) * (size_t)(rmax + 2) / 2);
+    if (!t)
+    {
+        perror("heat: disk spans");
+        exit(1);
+    }
+    for (int r = SpansMax + 1; r <= rmax; ++r)
+        for (int dy = 0, dx = r; dy <= r; ++dy)
+        {
+            while (dx * dx + dy * dy > r * r)
+                --dx;
+            t[r * (r + 1) / 2 + dy] = dx;
+        }
+    Spans = t;
+    SpansMax = rmax;
+}
+
+/* row[i] = max(row[i], t) для i < n */
+static void maxFill32(int *row, int n, int t)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i vt = _mm_set1_epi32(t);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i lt = _mm_cmplt_epi32(v, vt);
+        _mm_storeu_si128((__m128i *)(row + i), _mm_or_si128(_mm_and_si128(lt, vt), _mm_andnot_si128(lt, v)));
+    }
+#endif
+    for (; i < n; ++i)
+        if (row[i] < t)
+            row[i] = t;
+}
+
+static void maxFill8(uint8_t *row, int n, int t)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i vt = _mm_set1_epi8((char)t);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+        _mm_storeu_si128((__m128i *)(row + i), _mm_max_epu8(v, vt));
+    }
+#endif
+    for (; i < n; ++i)
+        if (row[i] < t)
+            row[i] = (uint8_t)t;
+}
+
+/* Диск (cx, cy, r, t) в пределах [x0, x1) x [y0, y1) (глобальные координаты)
+   буфера region, где region[0] - клетка (rx0, ry0), а rstride - шаг строки */
+static void applyDisk(void *region, int rstride, int elem, int rx0, int ry0,
+                      int cx, int cy, int r, int t, int x0, int x1, int y0, int y1)
+{
+    if (r < 0)
+        return;
+    reserveSpans(r);
+    const int *span = Spans + r * (r + 1) / 2;
+    int ya = cy - r > y0 ? cy - r : y0;
+    int yb = cy + r < y1 - 1 ? cy + r : y1 - 1;
+    for (int y = ya; y <= yb; ++y)
+    {
+        int hw = span[y > cy ? y - cy : cy - y];
+        int xa = cx - hw > x0 ? cx - hw : x0;
+        int xb = cx + hw < x1 - 1 ? cx + hw : x1 - 1;
+        if (xa > xb)
+            continue;
+        size_t at = (size_t)(y - ry0) * rstride + (size_t)(xa - rx0);
+        if (elem == 1)
+            maxFill8((uint8_t *)region + at, xb - xa + 1, t);
+        else
+            maxFill32((int *)region + at, xb - xa + 1, t);
+    }
+}
+
+/* Подогрев прямоугольника [x0, x1) x [y0, y1): с корзинами - только их
+   источники, каждый в пределах своей корзины (без двойной работы) */
+static void applySourcesRegion(void *region, int rstride, int elem, int rx0, int ry0,
+                               const HeatSources *src, int x0, int x1, int y0, int y1)
+{
+    const HeatBins *b = src->bins;
+    if (!b)
+    {
+        for (int i = 0; i < src->n; ++i)
+            applyDisk(region, rstride, elem, rx0, ry0, src->x[i], src->y[i], src->r[i], src->t[i],
+                      x0, x1, y0, y1);
+        return;
+    }
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    int bx1 = (x1 - 1) / b->size < b->binsX - 1 ? (x1 - 1) / b->size : b->binsX - 1;
+    int by1 = (y1 - 1) / b->size < b->binsY - 1 ? (y1 - 1) / b->size : b->binsY - 1;
+    for (int by = y0 / b->size; by <= by1; ++by)
+        for (int bx = x0 / b->size; bx <= bx1; ++bx)
+        {
+            int ax0 = bx * b->size > x0 ? bx * b->size : x0;
+            int ax1 = (bx + 1) * b->size < x1 ? (bx + 1) * b->size : x1;
+            int ay0 = by * b->size > y0 ? by * b->size : y0;
+            int ay1 = (by + 1) * b->size < y1 ? (by + 1) * b->size : y1;
+            int bin = by * b->binsX + bx;
+            for (int k = b->start[bin]; k < b->start[bin + 1]; ++k)
+            {
+                int i = b->items[k];
+                applyDisk(region, rstride, elem, rx0, ry0, src->x[i], src->y[i], src->r[i], src->t[i],
+                          ax0, ax1, ay0, ay1);
+            }
+        }
+}
+
+/* Корзины, которые задевает квадрат источника i (пустой диапазон, если он вне сетки) */
+static int sourceBins(const HeatBins *b, const HeatSources *src, int i, int w, int h,
+                      int *bx0, int *bx1, int *by0, int *by1)
+{
+    int r = src->r[i];
+    int xa = src->x[i] - r, xb = src->x[i] + r, ya = src->y[i] - r, yb = src->y[i] + r;
+    if (r < 0 || xb < 0 || yb < 0 || xa >= w || ya >= h)
+        return 0;
+    *bx0 = xa > 0 ? xa / b->size : 0;
+    *by0 = ya > 0 ? ya / b->size : 0;
+    *bx1 = (xb < w - 1 ? xb : w - 1) / b->size;
+    *by1 = (yb < h - 1 ? yb : h - 1) / b->size;
+    return 1;
+}
+
+void heatBinSources(HeatBins *b, const HeatSources *src, int w, int h)
+{
+    if (b->size <= 0)
+        b->size = 64;
+    b->binsX = (w + b->size - 1) / b->size;
+    b->binsY = (h + b->size - 1) / b->size;
+    int nb = b->binsX * b->binsY;
+    if (b->startCap < nb + 1)
+    {
+        free(b->start);
+        b->start = malloc(sizeof(int) * (size_t)(nb + 1));
+        b->startCap = nb + 1;
+    }
+    if (!b->start)
+    {
+        perror("heat: source bins");
+        exit(1);
+    }
+
+    /* подсчёт, префиксные суммы, раскладка (start[bin + 1] служит курсором) */
+    memset(b->start, 0, sizeof(int) * (size_t)(nb + 1));
+    int rmax = 0, bx0, bx1, by0, by1;
+    for (int i = 0; i < src->n; ++i)
+    {
+        if (src->r[i] > rmax)
+            rmax = src->r[i];
+        if (sourceBins(b, src, i, w, h, &bx0, &bx1, &by0, &by1))
+            for (int by = by0; by <= by1; ++by)
+                for (int bx = bx0; bx <= bx1; ++bx)
+                    ++b->start[by * b->binsX + bx + 1];
+    }
+    for (int k = 0; k < nb; ++k)
+        b->start[k + 1] += b->start[k];
+    if (b->itemCap < b->start[nb])
+    {
+        free(b->items);
+        b->items = malloc(sizeof(int) * (size_t)b->start[nb]);
+        b->itemCap = b->start[nb];
+        if (!b->items)
+        {
+            perror("heat: source bins");
+            exit(1);
+        }
+    }
+    for (int k = nb; k > 0; --k)
+        b->start[k] = b->start[k - 1];
+    b->start[0] = 0;
+    for (int i = 0; i < src->n; ++i)
+        if (sourceBins(b, src, i, w, h, &bx0, &bx1, &by0, &by1))
+            for (int by = by0; by <= by1; ++by)
+                for (int bx = bx0; bx <= bx1; ++bx)
+                    b->items[b->start[by * b->binsX + bx + 1]++] = i;
+    reserveSpans(rmax);
+}
+
+void heatApplySources(const HeatGrid *g, int ping, const HeatSources *src, int y0, int y1)
+{
+    if (y0 < 1) y0 = 1;
+    if (y1 > g->h - 1) y1 = g->h - 1;
+    applySourcesRegion(g->buf[ping], g->stride, g->elem, 0, 0, src, 1, g->w - 1, y0, y1);
+}
+
+void heatTile(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling,
+              int x0, int x1, int y0, int y1)
+{
+    static _Thread_local char *scratch = NULL;
+    static _Thread_local size_t scratchSize = 0;
+    HeatRowFn row = rowFn(g->elem);
+    const int w = g->w, h = g->h, elem = g->elem;
+    const size_t pitch = (size_t)g->stride * elem;
+
+    int rx0 = x0 - steps > 0 ? x0 - steps : 0, rx1 = x1 + steps < w ? x1 + steps : w;
+    int ry0 = y0 - steps > 0 ? y0 - steps : 0, ry1 = y1 + steps < h ? y1 + steps : h;
+    int rw = rx1 - rx0, rh = ry1 - ry0;
+    const size_t rpitch = (size_t)rw * elem, bytes = rpitch * rh;
+    if (scratchSize < 2 * bytes)
+    {
+        free(scratch);
+        scratch = malloc(2 * bytes);
+        scratchSize = 2 * bytes;
+    }
+    char *a = scratch, *b = scratch + bytes;
+    const char *cur = g->buf[ping];
+    for (int y = ry0; y < ry1; ++y)
+        memcpy(a + (y - ry0) * rpitch, cur + y * pitch + (size_t)rx0 * elem, rpitch);
+
+    for (int s = 1; s <= steps; ++s)
+    {
+        applySourcesRegion(a, rw, elem, rx0, ry0, src, rx0 > 1 ? rx0 : 1, rx1 < w - 1 ? rx1 : w - 1,
+                           ry0 > 1 ? ry0 : 1, ry1 < h - 1 ? ry1 : h - 1);
+
+        /* верные значения сужаются на клетку за шаг, кроме сторон на краю сетки */
+        int cx0 = rx0 == 0 ? 1 : rx0 + s, cx1 = rx1 == w ? w - 1 : rx1 - s;
+        int cy0 = ry0 == 0 ? 1 : ry0 + s, cy1 = ry1 == h ? h - 1 : ry1 - s;
+        for (int y = cy0; y < cy1 && cx0 < cx1; ++y)
+        {
+            size_t at = (y - ry0) * rpitch + (size_t)(cx0 - rx0 - 1) * elem;
+            /* строка шириной cx1-cx0+2: края (cx0-1, cx1) обнуляются, что верно
+               для краёв сетки и безвредно для уже неверного ореола */
+            row(a + at - rpitch, a + at, a + at + rpitch, b + at, cx1 - cx0 + 2, cooling);
+        }
+        if (ry0 == 0)
+            memset(b, 0, rpitch);
+        if (ry1 == h)
+            memset(b + (h - 1 - ry0) * rpitch, 0, rpitch);
+        char *t = a; a = b; b = t;
+    }
+
+    char *next = g->buf[ping ^ 1];
+    for (int y = y0; y < y1; ++y)
+        memcpy(next + y * pitch + (size_t)x0 * elem,
+               a + (y - ry0) * rpitch + (size_t)(x0 - rx0) * elem, (size_t)(x1 - x0) * elem);
+}
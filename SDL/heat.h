@@ -0,0 +1,153 @@
+#ifndef HEAT_H
+#define HEAT_H
+
+#include <stddef.h>
+
+/*
+ * Ядро явной схемы теплопроводности из app3.c:
+ *   u_{n+1} = u + (lap >> 2) - cooling,  lap = left + right + up + down - 4u,
+ * результат обрезается до 0..255, края сетки = 0.
+ * Все варианты (скалярный и векторные) дают побитно одинаковый результат.
+ */
+
+/*
+ * Сетка w x h с двойным буфером. Клетка хранится как int (elem = 4) или,
+ * поскольку температура всегда в 0..255, как uint8_t (elem = 1): тогда поле
+ * вчетверо меньше, а расширение до 16/32 бит делается только в регистрах.
+ */
+typedef struct
+{
+    int w, h;
+    int stride;   /* шаг строки в клетках */
+    int elem;     /* sizeof клетки: 4 или 1 */
+    void *buf[2];
+} HeatGrid;
+
+/* Одна строка: out[1..w-2] по трём входным строкам, out[0] = out[w-1] = 0 */
+typedef void (*HeatRowFn)(const void *up, const void *mid, const void *dn, void *out,
+                          int w, int cooling);
+
+/*
+ * Арена: один анонимный mmap под все буферы (выровнен по странице, при
+ * размере от 2 МБ просится THP через madvise), раздаётся кусками по 64 Б.
+ * Память из mmap уже обнулена.
+ */
+typedef struct
+{
+    char *base;
+    size_t size, used;
+} HeatArena;
+
+int heatArenaInit(HeatArena *a, size_t bytes);
+void *heatArenaAlloc(HeatArena *a, size_t bytes);
+
+/* Шаг строки (в клетках размера elem) для ширины w: кратен 64 Б и не кратен
+   4 КБ, чтобы соседние строки не попадали в одни и те же наборы кэша */
+int heatStride(int w, int elem);
+
+/*
+ * Равномерная сетка корзин size x size клеток: в корзине - индексы
+ * источников, чей квадрат (x +- r, y +- r) её задевает. Подогрев области
+ * перебирает только её корзины, а не все источники.
+ */
+typedef struct
+{
+    int size;
+    int binsX, binsY;
+    int *start;     /* binsX * binsY + 1: источники корзины b - items[start[b] .. start[b+1]) */
+    int *items;
+    int startCap, itemCap;
+} HeatBins;
+
+/* Источники тепла: диски радиуса r[i] с температурой t[i] в точках (x[i], y[i]);
+   bins (может быть NULL) - их раскладка по корзинам из heatBinSources */
+typedef struct
+{
+    const int *x, *y, *r, *t;
+    int n;
+    const HeatBins *bins;
+} HeatSources;
+
+/* Раскладывает src по корзинам сетки w x h (size = 0 - по умолчанию 64) и
+   заранее строит таблицы дисков для всех радиусов src: после неё подогрев
+   можно звать из нескольких потоков */
+void heatBinSources(HeatBins *b, const HeatSources *src, int w, int h);
+
+/* Диффузия строк [y0, y1) из buf[ping] в buf[ping ^ 1]; строки 0 и h-1 обнуляются */
+void heatDiffuseRows(const HeatGrid *g, int ping, int cooling, int y0, int y1);
+
+/* Диффузия прямоугольника [x0, x1) x [y0, y1) из buf[ping] в buf[ping ^ 1]
+   (клетки на краях сетки обнуляются), соседние клетки вне прямоугольника не
+   пишутся. Возвращает 1, если в результате есть ненулевые клетки */
+int heatDiffuseRect(const HeatGrid *g, int ping, int cooling, int x0, int x1, int y0, int y1);
+
+/* Подогрев строк [y0, y1) буфера buf[ping]: max(u, t) внутри дисков, края не трогаются */
+void heatApplySources(const HeatGrid *g, int ping, const HeatSources *src, int y0, int y1);
+
+/* Выбранная реализация строки: scalar / sse41 / avx2 / avx512 */
+const char *heatKernelName(void);
+
+/*
+ * Временной блокинг: steps шагов (подогрев + диффузия) для тайла
+ * [x0, x1) x [y0, y1) за один проход. Тайл с ореолом в steps клеток копируется
+ * в буфер потока, ореол пересчитывается и с каждым шагом сужается на клетку,
+ * итог (побитно равный пошаговому) пишется в buf[ping ^ 1], buf[ping] не меняется.
+ */
+void heatTile(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling,
+              int x0, int x1, int y0, int y1);
+
+/*
+ * heat_pool.c: steps шагов (подогрев -> диффузия с краями -> смена буфера)
+ * в постоянном пуле потоков. Строки делятся на полосы по потокам, между
+ * фазами - барьер. Возвращает индекс буфера g->buf[] с результатом.
+ * Число потоков - HEAT_THREADS (0 - все ядра, по умолчанию 1).
+ * HEAT_TILE=WxH включает временной блокинг тайлами WxH (см. heatTile),
+ * HEAT_FUSE=K - сколько шагов сливается в один проход (по умолчанию все).
+ * HEAT_ACTIVE=WxH (или 1 - 128x16) включает учёт активных тайлов: за шаг
+ * считаются только тайлы с ненулевыми клетками, их соседи и тайлы под дисками
+ * источников, остальные заведомо остаются нулями и пропускаются.
+ * HEAT_PROCS=N (N > 1) передаёт шаги heatSlabSteps, HEAT_SOLVER=adi - heatAdiSteps.
+ * Все настройки читаются через simOption: HEAT_THREADS=N или --heat-threads=N и т.д.
+ */
+int heatSteps(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling);
+int heatThreads(void);
+
+/*
+ * heat_slab.c: те же шаги в N процессах-рабочих (HEAT_PROCS=N), каждый со своей
+ * горизонтальной полосой на своём узле NUMA; граничные строки - через кольца в
+ * общей памяти. Рабочие запускаются при первом вызове из g->buf[ping], дальше
+ * сетка живёт у них, а результат собирается в g->buf[] для вывода.
+ * Возвращает индекс буфера с результатом или -1, если режим выключен.
+ */
+int heatSlabSteps(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling);
+
+/*
+ * heat_adi.c: неявная схема переменных направлений (Писмен - Рэкфорд) вместо
+ * явной: steps явных шагов покрываются шагами ADI не длиннее HEAT_ADI_DT
+ * (по умолчанию 16) явных. Поле во float заводится при первом вызове для
+ * сетки из g->buf[ping], результат округляется в g->buf[ping ^ 1] (его индекс
+ * и возвращается). Результат близок к явной схеме, но не побитно равен ей.
+ */
+int heatAdiSteps(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling);
+/* Задаёт шаг ADI в явных шагах вместо HEAT_ADI_DT (0 - снова по HEAT_ADI_DT) */
+void heatAdiSetDt(int dt);
+
+/*
+ * heat_render.c: вывод сетки в кадр sim.c (simFramebuffer) клетками
+ * scale x scale по палитре palette[256]. Рисуются только клетки, чья
+ * температура изменилась с прошлого кадра; их полосы отмечаются simMarkDirty.
+ */
+typedef struct
+{
+    int w, h;                  /* видимая в окне часть сетки */
+    int scale;
+    const int *palette;
+    unsigned char *shadow;     /* показанные температуры, w x h */
+    unsigned long long *bits;  /* изменившиеся клетки строки */
+    int full;                  /* следующий кадр рисуется целиком */
+} HeatView;
+
+void heatViewInit(HeatView *v, const HeatGrid *g, int scale, const int *palette);
+void heatRender(HeatView *v, const HeatGrid *g, int ping);
+
+#endif
@@ -0,0 +1,414 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "heat.h"
+#include "sim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEAT_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Неявная схема переменных направлений (Писмен - Рэкфорд) для того же
+ * уравнения, что и явный шаг: u_t = alpha * lap(u), alpha = 1/4 на шаг явной
+ * схемы. Шаг ADI длиной dt явных шагов (a = alpha * dt / 2):
+ *
+ *   (I - a dxx) u* = (I + a dyy) u      - неявно по x
+ *   (I - a dyy) u' = (I + a dxx) u*     - неявно по y
+ *
+ * устойчив при любом dt, так что десятки явных шагов заменяются одним.
+ * Края - нули (Дирихле), как в явной схеме; подогрев - перед шагом,
+ * охлаждение cooling * dt - после, с обрезкой в 0..255.
+ *
+ * Поле хранится во float. Прогонка (метод Томаса) по y идёт вдоль
+ * медленного индекса: каждая строка рекуррентности - непрерывный вектор из
+ * независимых систем, и внутренний цикл - одна векторная операция над
+ * строками (lineMix, версии по cpuid, как строки в heat.c). Прогонка по x
+ * идёт вдоль строк, по ADI_ROWS строк вперемешку; явные половины шага - тоже
+ * lineMix. Коэффициенты прогонки у всех систем одинаковы и считаются один раз
+ * на (n, a).
+ */
+
+#define ADI_ROWS 8
+#define ADI_STRIP 128
+#define ADI_DEFAULT_DT 16
+
+typedef struct
+{
+    int n;
+    float a;
+    float *inv;    /* 1 / диагональ после исключения */
+    float *up;     /* a * inv: вклад следующего неизвестного на обратном ходе */
+} Coef;
+
+static struct
+{
+    int w, h, wp;            /* wp - шаг строк, во float */
+    const void *key;         /* сетка, для которой заведено поле */
+    float *u, *t;            /* поле и промежуточное u* полушага */
+    Coef cx, cy;
+    int dtMax;
+    int dtSet;               /* heatAdiSetDt: шаг важнее HEAT_ADI_DT */
+    uint64_t steps, adiSteps, ns;
+} Adi;
+
+static uint64_t nanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *adiAlloc(size_t bytes)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, 64, bytes ? bytes : 64) != 0)
+    {
+        perror("heat: adi");
+        exit(1);
+    }
+    return p;
+}
+
+/* Прямой ход для -a u[i-1] + (1 + 2a) u[i] - a u[i+1], u[0] = u[n-1] = 0 */
+static void coefInit(Coef *c, int n, float a)
+{
+    if (c->n == n && c->a == a)
+        return;
+    if (c->n != n)
+    {
+        free(c->inv);
+        free(c->up);
+        c->inv = adiAlloc((size_t)n * sizeof(float));
+        c->up = adiAlloc((size_t)n * sizeof(float));
+    }
+    c->n = n;
+    c->a = a;
+    float cp = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        c->inv[i] = 0;
+        c->up[i] = 0;
+    }
+    for (int i = 1; i < n - 1; ++i)
+    {
+        c->inv[i] = 1.0f / (1 + 2 * a - a * cp);
+        c->up[i] = a * c->inv[i];
+        cp = c->up[i];
+    }
+}
+
+/* o = k0 * x0 + k1 * x1 + k2 * x2 поэлементно; o может совпадать с x0 */
+typedef void (*LineMixFn)(float *o, const float *x0, const float *x1, const float *x2, int m,
+                          float k0, float k1, float k2);
+/* o = clamp(o - cool, 0, 255) */
+typedef void (*LineClampFn)(float *o, int m, float cool);
+
+static void lineMixScalar(float *o, const float *x0, const float *x1, const float *x2, int m,
+                          float k0, float k1, float k2)
+{
+    for (int j = 0; j < m; ++j)
+        o[j] = k0 * x0[j] + k1 * x1[j] + k2 * x2[j];
+}
+
+static void lineClampScalar(float *o, int m, float cool)
+{
+    for (int j = 0; j < m; ++j)
+    {
+        float v = o[j] - cool;
+        o[j] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+}
+
+#ifdef HEAT_X86
+__attribute__((target("avx2,fma")))
+static void lineMixAvx2(float *o, const float *x0, const float *x1, const float *x2, int m,
+                        float k0, float k1, float k2)
+{
+    const __m256 v0 = _mm256_set1_ps(k0), v1 = _mm256_set1_ps(k1), v2 = _mm256_set1_ps(k2);
+    int j = 0;
+    for (; j + 8 <= m; j += 8)
+    {
+        __m256 r = _mm256_mul_ps(v0, _mm256_loadu_ps(x0 + j));
+        r = _mm256_fmadd_ps(v1, _mm256_loadu_ps(x1 + j), r);
+        r = _mm256_fmadd_ps(v2, _mm256_loadu_ps(x2 + j), r);
+        _mm256_storeu_ps(o + j, r);
+    }
+    lineMixScalar(o + j, x0 + j, x1 + j, x2 + j, m - j, k0, k1, k2);
+}
+
+__attribute__((target("avx2")))
+static void lineClampAvx2(float *o, int m, float cool)
+{
+    const __m256 c = _mm256_set1_ps(cool), lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(255);
+    int j = 0;
+    for (; j + 8 <= m; j += 8)
+        _mm256_storeu_ps(o + j, _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(o + j), c), lo), hi));
+    lineClampScalar(o + j, m - j, cool);
+}
+
+__attribute__((target("avx512f")))
+static void lineMixAvx512(float *o, const float *x0, const float *x1, const float *x2, int m,
+                          float k0, float k1, float k2)
+{
+    const __m512 v0 = _mm512_set1_ps(k0), v1 = _mm512_set1_ps(k1), v2 = _mm512_set1_ps(k2);
+    int j = 0;
+    for (; j + 16 <= m; j += 16)
+    {
+        __m512 r = _mm512_mul_ps(v0, _mm512_loadu_ps(x0 + j));
+        r = _mm512_fmadd_ps(v1, _mm512_loadu_ps(x1 + j), r);
+        r = _mm512_fmadd_ps(v2, _mm512_loadu_ps(x2 + j), r);
+        _mm512_storeu_ps(o + j, r);
+    }
+    lineMixScalar(o + j, x0 + j, x1 + j, x2 + j, m - j, k0, k1, k2);
+}
+
+__attribute__((target("avx512f")))
+static void lineClampAvx512(float *o, int m, float cool)
+{
+    const __m512 c = _mm512_set1_ps(cool), lo = _mm512_setzero_ps(), hi = _mm512_set1_ps(255);
+    int j = 0;
+    for (; j + 16 <= m; j += 16)
+        _mm512_storeu_ps(o + j, _mm512_min_ps(_mm512_max_ps(_mm512_sub_ps(_mm512_loadu_ps(o + j), c), lo), hi));
+    lineClampScalar(o + j, m - j, cool);
+}
+#endif
+
+static LineMixFn lineMix = lineMixScalar;
+static LineClampFn lineClamp = lineClampScalar;
+
+/* HEAT_KERNEL=scalar оставляет скалярные строки и здесь */
+static void selectLines(void)
+{
+    const char *want = simOption("heat-kernel");
+    if (want && strcmp(want, "scalar") == 0)
+        return;
+#ifdef HEAT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        lineMix = lineMixAvx512;
+        lineClamp = lineClampAvx512;
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        lineMix = lineMixAvx2;
+        lineClamp = lineClampAvx2;
+    }
+#endif
+}
+
+/* Прогонка m систем сразу: система j - столбец j, строки 0..n-1 с шагом pitch */
+static void solveLines(float *f, int n, int m, int pitch, const Coef *c)
+{
+    /* полосами по ADI_STRIP систем: прямой и обратный ход полосы - в кэше */
+    for (int j0 = 0; j0 < m; j0 += ADI_STRIP)
+    {
+        const int mj = m - j0 < ADI_STRIP ? m - j0 : ADI_STRIP;
+        for (int i = 1; i < n - 1; ++i)
+        {
+            float *fi = f + (size_t)i * pitch + j0;
+            lineMix(fi, fi, fi - pitch, fi, mj, c->inv[i], c->up[i], 0);   /* (f + a f[i-1]) * inv */
+        }
+        for (int i = n - 3; i >= 1; --i)
+        {
+            float *fi = f + (size_t)i * pitch + j0;
+            lineMix(fi, fi, fi + pitch, fi, mj, 1, c->up[i], 0);
+        }
+    }
+}
+
+/* Прогонка вдоль строк: по ADI_ROWS строк вперемешку, чтобы независимые
+   рекуррентности шли параллельно на конвейере (вектор поперёк строк
+   потребовал бы gather с шагом строки). За f[rows - 1] должны идти ещё
+   ADI_ROWS - 1 нулевых строк: на них смотрят пустые места последней группы */
+static void solveRows(float *f, int rows, int n, int pitch, const Coef *c)
+{
+    const float a = c->a;
+    for (int r0 = 0; r0 < rows; r0 += ADI_ROWS)
+    {
+        float *p[ADI_ROWS];
+        const int k1 = rows - r0 < ADI_ROWS ? rows - r0 : ADI_ROWS;
+        for (int k = 0; k < ADI_ROWS; ++k)
+            p[k] = f + (size_t)(k < k1 ? r0 + k : rows + k - k1) * pitch;
+        for (int i = 1; i < n - 1; ++i)
+        {
+            const float inv = c->inv[i];
+            for (int k = 0; k < ADI_ROWS; ++k)
+                p[k][i] = (p[k][i] + a * p[k][i - 1]) * inv;
+        }
+        for (int i = n - 3; i >= 1; --i)
+        {
+            const float up = c->up[i];
+            for (int k = 0; k < ADI_ROWS; ++k)
+                p[k][i] += up * p[k][i + 1];
+        }
+    }
+}
+
+/* out = (I + a dyy) in: вдоль столбцов, крайние строки - нули */
+static void halfCols(const float *in, float *out, int h, int w, int pitch, float a)
+{
+    memset(out, 0, (size_t)w * sizeof(float));
+    memset(out + (size_t)(h - 1) * pitch, 0, (size_t)w * sizeof(float));
+    for (int y = 1; y < h - 1; ++y)
+    {
+        const float *c = in + (size_t)y * pitch;
+        lineMix(out + (size_t)y * pitch, c, c - pitch, c + pitch, w, 1 - 2 * a, a, a);
+    }
+}
+
+/* out = (I + a dxx) in: вдоль строк (соседи - те же строки со сдвигом на клетку),
+   крайние столбцы и строки - нули */
+static void halfRows(const float *in, float *out, int h, int w, int pitch, float a)
+{
+    memset(out, 0, (size_t)w * sizeof(float));
+    memset(out + (size_t)(h - 1) * pitch, 0, (size_t)w * sizeof(float));
+    for (int y = 1; y < h - 1; ++y)
+    {
+        const float *c = in + (size_t)y * pitch;
+        float *o = out + (size_t)y * pitch;
+        lineMix(o + 1, c + 1, c, c + 2, w - 2, 1 - 2 * a, a, a);
+        o[0] = 0;
+        o[w - 1] = 0;
+    }
+}
+
+/* Подогрев: диски источников, внутри [1, w-1) x [1, h-1), max с температурой */
+static void heatSourcesF(const HeatSources *src)
+{
+    for (int i = 0; src && i < src->n; ++i)
+    {
+        const int cx = src->x[i], cy = src->y[i], r = src->r[i];
+        const float t = (float)src->t[i];
+        for (int dy = -r, dx = 0; dy <= r; ++dy)
+        {
+            int y = cy + dy;
+            for (dx = r; dx * dx + dy * dy > r * r; --dx)
+                ;
+            if (y < 1 || y > Adi.h - 2)
+                continue;
+            int xa = cx - dx > 1 ? cx - dx : 1;
+            int xb = cx + dx < Adi.w - 2 ? cx + dx : Adi.w - 2;
+            float *row = Adi.u + (size_t)y * Adi.wp;
+            for (int x = xa; x <= xb; ++x)
+                row[x] = row[x] < t ? t : row[x];
+        }
+    }
+}
+
+static void adiStep(const HeatSources *src, float dt, float cooling)
+{
+    const int w = Adi.w, h = Adi.h;
+    const float a = dt / 8;   /* alpha * dt / 2, alpha = 1/4 */
+    coefInit(&Adi.cx, w, a);
+    coefInit(&Adi.cy, h, a);
+
+    heatSourcesF(src);
+    halfCols(Adi.u, Adi.t, h, w, Adi.wp, a);    /* (I + a dyy) u */
+    solveRows(Adi.t, h, w, Adi.wp, &Adi.cx);    /* неявно по x: u* */
+    halfRows(Adi.t, Adi.u, h, w, Adi.wp, a);    /* (I + a dxx) u* */
+    solveLines(Adi.u, h, w, Adi.wp, &Adi.cy);   /* неявно по y */
+
+    for (int y = 0; y < h; ++y)
+        lineClamp(Adi.u + (size_t)y * Adi.wp, w, cooling * dt);
+}
+
+static void adiReport(void)
+{
+    if (Adi.adiSteps)
+        fprintf(stderr, "heat: adi %llu steps for %llu explicit (dt up to %d), %.1f ns per cell-step\n",
+                (unsigned long long)Adi.adiSteps, (unsigned long long)Adi.steps, Adi.dtMax,
+                (double)Adi.ns / ((double)Adi.adiSteps * Adi.w * Adi.h));
+}
+
+/* Наибольший шаг ADI: heatAdiSetDt, иначе HEAT_ADI_DT */
+static int adiDt(void)
+{
+    long long dt = Adi.dtSet > 0 ? Adi.dtSet : simOptionInt("heat-adi-dt", ADI_DEFAULT_DT);
+    return dt > 0 ? (int)dt : ADI_DEFAULT_DT;
+}
+
+/* Поле ADI заводится для сетки при первом вызове (и при смене сетки) из g->buf[ping] */
+static void adiInit(const HeatGrid *g, int ping)
+{
+    Adi.dtMax = adiDt();
+    if (!Adi.key)
+    {
+        selectLines();
+        fprintf(stderr, "heat: adi solver, dt up to %d explicit steps\n", Adi.dtMax);
+        atexit(adiReport);
+    }
+    free(Adi.u);
+    free(Adi.t);
+    Adi.key = g->buf[0];
+    Adi.w = g->w;
+    Adi.h = g->h;
+    /* шаг строк кратен 64 байтам, но не 4 КБ: иначе ADI_ROWS строк прогонки
+       ложатся в одни и те же наборы кэша */
+    Adi.wp = ((g->w + 15) & ~15) + (((g->w + 15) & ~15) % 1024 == 0 ? 16 : 0);
+    Adi.u = adiAlloc((size_t)Adi.h * Adi.wp * sizeof(float));
+    /* у t - запасные строки под хвост последней группы solveRows */
+    Adi.t = adiAlloc((size_t)(Adi.h + ADI_ROWS - 1) * Adi.wp * sizeof(float));
+    memset(Adi.u, 0, (size_t)Adi.h * Adi.wp * sizeof(float));
+    memset(Adi.t, 0, (size_t)(Adi.h + ADI_ROWS - 1) * Adi.wp * sizeof(float));
+
+    const size_t pitch = (size_t)g->stride * g->elem;
+    for (int y = 1; y < g->h - 1; ++y)
+    {
+        const char *row = (const char *)g->buf[ping] + y * pitch;
+        for (int x = 1; x < g->w - 1; ++x)
+            Adi.u[(size_t)y * Adi.wp + x] = g->elem == 1 ? ((const unsigned char *)row)[x] : ((const int *)row)[x];
+    }
+}
+
+void heatAdiSetDt(int dt)
+{
+    Adi.dtSet = dt > 0 ? dt : 0;
+    if (Adi.key)
+        Adi.dtMax = adiDt();
+}
+
+int heatAdiSteps(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling)
+{
+    if (Adi.key != g->buf[0] || Adi.w != g->w || Adi.h != g->h)
+        adiInit(g, ping);
+    uint64_t t0 = nanos();
+#ifdef HEAT_X86
+    /* хвосты прогонки вдали от источников уходят в денормалы, а они на порядки
+       медленнее; в 0..255 такие значения всё равно округляются в 0 */
+    const unsigned csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);   /* FTZ | DAZ */
+#endif
+
+    /* steps явных шагов - n шагов ADI поровну, каждый не длиннее dtMax */
+    int n = (steps + Adi.dtMax - 1) / Adi.dtMax;
+    for (int k = 0; k < n; ++k)
+        adiStep(src, (float)steps / n, (float)cooling);
+
+#ifdef HEAT_X86
+    _mm_setcsr(csr);
+#endif
+
+    int out = ping ^ 1;
+    const size_t pitch = (size_t)g->stride * g->elem;
+    for (int y = 0; y < g->h; ++y)
+    {
+        const float *u = Adi.u + (size_t)y * Adi.wp;
+        char *row = (char *)g->buf[out] + y * pitch;
+        if (g->elem == 1)
+            for (int x = 0; x < g->w; ++x)
+                ((unsigned char *)row)[x] = (unsigned char)(u[x] + 0.5f);
+        else
+            for (int x = 0; x < g->w; ++x)
+                ((int *)row)[x] = (int)(u[x] + 0.5f);
+    }
+    Adi.steps += (uint64_t)steps;
+    Adi.adiSteps += (uint64_t)n;
+    Adi.ns += nanos() - t0;
+    return out;
+}
@@ -0,0 +1,527 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "heat.h"
+#include "sim.h"
+
+/*
+ * Постоянный пул потоков для heatSteps. Потоки создаются один раз и спят на
+ * условной переменной между кадрами; внутри кадра фазы (подогрев, диффузия)
+ * разделены спин-барьером. Строки [0, h) делятся на полосы по потокам, полоса
+ * раздаётся кусками по атомарному счётчику: сначала свой, затем чужие
+ * (воровство работы), поэтому полосы с источниками не тормозят остальных.
+ * Поток 0 - вызывающий heatSteps.
+ *
+ * В режиме HEAT_TILE вместо строк раздаются тайлы: за одну фазу каждый тайл
+ * проходит HEAT_FUSE шагов сразу (heatTile) и пишется во второй буфер.
+ *
+ * В режиме HEAT_ACTIVE сетка тоже делится на тайлы, но шаг считается только
+ * для активных: поток 0 перед шагом собирает их в список (ненулевые тайлы,
+ * их соседи, тайлы под дисками источников), потоки разбирают список.
+ * Инвариант: тайл вне списка hot[b] целиком нулевой в buf[b].
+ */
+
+#define SPINS_BEFORE_YIELD 256
+
+enum { PHASE_HEAT, PHASE_DIFFUSE, PHASE_TILES, PHASE_ACTIVE };
+
+typedef struct
+{
+    HeatGrid grid;
+    int ping;
+    const HeatSources *src;
+    int steps;
+    int cooling;
+    int tilesX;
+    int active;
+} Job;
+
+/* Полоса строк одного потока; своя кэш-линия, чтобы счётчики не мешали друг другу */
+typedef struct
+{
+    _Alignas(64) atomic_int next;
+    int begin, end;
+} Band;
+
+typedef struct
+{
+    _Alignas(64) uint64_t busy; /* нс внутри фаз */
+    uint64_t rows;              /* обработано строк или тайлов (за фазу) */
+    uint64_t stolen;            /* кусков взято из чужих полос */
+} WorkerStat;
+
+static struct
+{
+    int threads;
+    int chunk;
+    int tileW, tileH;
+    int fuse;
+    pthread_t *tid;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint64_t generation;
+    Job job;
+    Band *bands;
+    WorkerStat *stats;
+    atomic_int arrived;
+    atomic_uint barrierGen;
+    uint64_t wall;
+    uint64_t jobs;
+    uint64_t cellSteps; /* клеток * шагов за всё время, для оценки трафика */
+    int elem;
+} Pool = { .threads = 0, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+/* Карта активности для HEAT_ACTIVE; перестраивается при смене сетки */
+static struct
+{
+    int tileW, tileH;
+    int tilesX, tilesY;
+    const void *key;            /* g->buf[0] сетки, для которой построена карта */
+    unsigned char *hot[2];      /* тайл может быть ненулевым в buf[b] */
+    int *list[2];               /* те же тайлы списком */
+    int count[2];
+    int *work;                  /* тайлы текущего шага */
+    unsigned char *result;      /* work[u] дал ненулевой результат */
+    int workCount;
+    unsigned *mark;
+    unsigned stamp;
+    uint64_t worked, total;     /* для отчёта: посчитано тайлов / всего тайлов */
+} Active;
+
+/* Корзины источников; перестраиваются в каждом heatSteps (источники двигаются между кадрами) */
+static HeatBins Bins;
+
+static uint64_t nanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void resetBands(void)
+{
+    for (int t = 0; t < Pool.threads; ++t)
+        atomic_store_explicit(&Pool.bands[t].next, Pool.bands[t].begin, memory_order_relaxed);
+}
+
+/* Последний пришедший поток готовит полосы к следующей фазе и отпускает остальных */
+static void barrier(void)
+{
+    unsigned gen = atomic_load_explicit(&Pool.barrierGen, memory_order_acquire);
+    if (atomic_fetch_add_explicit(&Pool.arrived, 1, memory_order_acq_rel) == Pool.threads - 1)
+    {
+        atomic_store_explicit(&Pool.arrived, 0, memory_order_relaxed);
+        resetBands();
+        atomic_store_explicit(&Pool.barrierGen, gen + 1, memory_order_release);
+        return;
+    }
+    for (int spin = 0; atomic_load_explicit(&Pool.barrierGen, memory_order_acquire) == gen; ++spin)
+    {
+        if (spin >= SPINS_BEFORE_YIELD)
+            sched_yield();
+    }
+}
+
+/* Тайл t сразу на min(fuse, оставшиеся) шагов; число шагов лежит в j->steps */
+static void runTile(const Job *j, int ping, int t)
+{
+    int x0 = (t % j->tilesX) * Pool.tileW, y0 = (t / j->tilesX) * Pool.tileH;
+    int x1 = x0 + Pool.tileW < j->grid.w ? x0 + Pool.tileW : j->grid.w;
+    int y1 = y0 + Pool.tileH < j->grid.h ? y0 + Pool.tileH : j->grid.h;
+    int k = Pool.fuse > 0 && Pool.fuse < j->steps ? Pool.fuse : j->steps;
+    heatTile(&j->grid, ping, j->src, k, j->cooling, x0, x1, y0, y1);
+}
+
+static void runActive(const Job *j, int ping, int u)
+{
+    int t = Active.work[u];
+    int x0 = (t % Active.tilesX) * Active.tileW, y0 = (t / Active.tilesX) * Active.tileH;
+    int x1 = x0 + Active.tileW < j->grid.w ? x0 + Active.tileW : j->grid.w;
+    int y1 = y0 + Active.tileH < j->grid.h ? y0 + Active.tileH : j->grid.h;
+    Active.result[u] = (unsigned char)heatDiffuseRect(&j->grid, ping, j->cooling, x0, x1, y0, y1);
+}
+
+static void phase(int id, const Job *j, int kind, int ping)
+{
+    WorkerStat *st = &Pool.stats[id];
+    uint64_t t0 = nanos();
+    for (int k = 0; k < Pool.threads; ++k)
+    {
+        Band *b = &Pool.bands[(id + k) % Pool.threads];
+        int y0;
+        while ((y0 = atomic_fetch_add_explicit(&b->next, Pool.chunk, memory_order_relaxed)) < b->end)
+        {
+            int y1 = y0 + Pool.chunk < b->end ? y0 + Pool.chunk : b->end;
+            if (kind == PHASE_HEAT)
+                heatApplySources(&j->grid, ping, j->src, y0, y1);
+            else if (kind == PHASE_DIFFUSE)
+                heatDiffuseRows(&j->grid, ping, j->cooling, y0, y1);
+            else if (kind == PHASE_TILES)
+                for (int t = y0; t < y1; ++t)
+                    runTile(j, ping, t);
+            else
+                for (int u = y0; u < y1; ++u)
+                    runActive(j, ping, u);
+            st->rows += (uint64_t)(y1 - y0);
+            st->stolen += k != 0;
+        }
+    }
+    st->busy += nanos() - t0;
+}
+
+/* Полосы поровну (строк или тайлов), куски - примерно по четверти полосы */
+static void setBands(int units, int tiles)
+{
+    int T = Pool.threads;
+    for (int t = 0; t < T; ++t)
+    {
+        Pool.bands[t].begin = (int)((long long)units * t / T);
+        Pool.bands[t].end = (int)((long long)units * (t + 1) / T);
+    }
+    int band = (units + T - 1) / T;
+    Pool.chunk = tiles ? 1 : band >= 16 ? band / 4 : (band > 0 ? band : 1);
+}
+
+static void markHot(int b, int t)
+{
+    if (!Active.hot[b][t])
+    {
+        Active.hot[b][t] = 1;
+        Active.list[b][Active.count[b]++] = t;
+    }
+}
+
+static void addWork(int t)
+{
+    if (Active.mark[t] != Active.stamp)
+    {
+        Active.mark[t] = Active.stamp;
+        Active.work[Active.workCount++] = t;
+    }
+}
+
+/* Поток 0 перед шагом: подогрев, тайлы под дисками - в hot, список работ */
+static void activePrepare(const Job *j, int ping)
+{
+    const HeatGrid *g = &j->grid;
+    if (j->src && j->src->n > 0)
+    {
+        heatApplySources(g, ping, j->src, 0, g->h);
+        for (int i = 0; i < j->src->n; ++i)
+        {
+            int r = j->src->r[i];
+            int xa = j->src->x[i] - r, xb = j->src->x[i] + r;
+            int ya = j->src->y[i] - r, yb = j->src->y[i] + r;
+            if (xa < 1) xa = 1;
+            if (ya < 1) ya = 1;
+            if (xb > g->w - 2) xb = g->w - 2;
+            if (yb > g->h - 2) yb = g->h - 2;
+            for (int ty = ya / Active.tileH; ty <= yb / Active.tileH && ya <= yb; ++ty)
+                for (int tx = xa / Active.tileW; tx <= xb / Active.tileW && xa <= xb; ++tx)
+                    markHot(ping, ty * Active.tilesX + tx);
+        }
+    }
+
+    /* ненулевой тайл греет соседей по кресту (шаблон достаёт на одну клетку);
+       тайлы, ненулевые во втором буфере, пересчитываются - так они обнуляются */
+    ++Active.stamp;
+    Active.workCount = 0;
+    for (int k = 0; k < Active.count[ping]; ++k)
+    {
+        int t = Active.list[ping][k], tx = t % Active.tilesX, ty = t / Active.tilesX;
+        addWork(t);
+        if (tx > 0) addWork(t - 1);
+        if (tx < Active.tilesX - 1) addWork(t + 1);
+        if (ty > 0) addWork(t - Active.tilesX);
+        if (ty < Active.tilesY - 1) addWork(t + Active.tilesX);
+    }
+    for (int k = 0; k < Active.count[ping ^ 1]; ++k)
+        addWork(Active.list[ping ^ 1][k]);
+
+    Active.worked += (uint64_t)Active.workCount;
+    Active.total += (uint64_t)Active.tilesX * Active.tilesY;
+    setBands(Active.workCount, 0);
+}
+
+/* Поток 0 после шага: новый список ненулевых тайлов второго буфера */
+static void activeCollect(int ping)
+{
+    int b = ping ^ 1;
+    for (int k = 0; k < Active.count[b]; ++k)
+        Active.hot[b][Active.list[b][k]] = 0;
+    Active.count[b] = 0;
+    for (int u = 0; u < Active.workCount; ++u)
+        if (Active.result[u])
+            markHot(b, Active.work[u]);
+}
+
+static void runJob(int id, Job j)
+{
+    int ping = j.ping;
+    if (j.active)
+    {
+        for (int s = 0; s < j.steps; ++s)
+        {
+            if (id == 0)
+                activePrepare(&j, ping);
+            barrier();
+            phase(id, &j, PHASE_ACTIVE, ping);
+            barrier();
+            if (id == 0)
+                activeCollect(ping);
+            ping ^= 1;
+        }
+        return;
+    }
+    if (j.tilesX > 0)
+    {
+        while (j.steps > 0)
+        {
+            phase(id, &j, PHASE_TILES, ping);
+            barrier();
+            ping ^= 1;
+            j.steps -= Pool.fuse > 0 && Pool.fuse < j.steps ? Pool.fuse : j.steps;
+        }
+        return;
+    }
+    for (int s = 0; s < j.steps; ++s)
+    {
+        if (j.src && j.src->n > 0)
+        {
+            phase(id, &j, PHASE_HEAT, ping);
+            barrier();
+        }
+        phase(id, &j, PHASE_DIFFUSE, ping);
+        barrier();
+        ping ^= 1;
+    }
+}
+
+static void *workerMain(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&Pool.lock);
+        while (Pool.generation == seen)
+            pthread_cond_wait(&Pool.wake, &Pool.lock);
+        seen = Pool.generation;
+        Job j = Pool.job;
+        pthread_mutex_unlock(&Pool.lock);
+        runJob(id, j);
+    }
+    return NULL;
+}
+
+/* Поле за шаг читается и пишется целиком: ~2*w*h*elem байт. Сколько из них
+   сэкономлено узким хранением против int - печатается при выходе */
+static void trafficReport(void)
+{
+    if (Pool.wall == 0)
+        return;
+    double secs = Pool.wall * 1e-9;
+    double bytes = 2.0 * (double)Pool.cellSteps * Pool.elem;
+    double wide = 2.0 * (double)Pool.cellSteps * sizeof(int);
+    fprintf(stderr, "heat: %s storage, field traffic %.2f GB/s", Pool.elem == 1 ? "u8" : "int",
+            bytes / secs * 1e-9);
+    if (Pool.elem < (int)sizeof(int))
+        fprintf(stderr, " (int would move %.2f GB/s, saved %.2f GB/s)", wide / secs * 1e-9,
+                (wide - bytes) / secs * 1e-9);
+    fputc('\n', stderr);
+}
+
+static void poolReport(void)
+{
+    trafficReport();
+    if (Active.total > 0)
+        fprintf(stderr, "heat: %dx%d active tiles, %.1f%% of the grid computed per step\n",
+                Active.tileW, Active.tileH, 100.0 * Active.worked / Active.total);
+    if (Pool.threads <= 1 || Pool.wall == 0)
+        return;
+    uint64_t busy = 0;
+    for (int t = 0; t < Pool.threads; ++t)
+        busy += Pool.stats[t].busy;
+    fprintf(stderr, "heat: %d threads, %llu jobs, parallel efficiency %.1f%%\n",
+            Pool.threads, (unsigned long long)Pool.jobs,
+            100.0 * busy / ((double)Pool.wall * Pool.threads));
+    for (int t = 0; t < Pool.threads; ++t)
+    {
+        const WorkerStat *st = &Pool.stats[t];
+        fprintf(stderr, "heat:   thread %2d busy %5.1f%%  rows %llu  stolen chunks %llu\n", t,
+                100.0 * st->busy / Pool.wall, (unsigned long long)st->rows,
+                (unsigned long long)st->stolen);
+    }
+}
+
+static void poolInit(void)
+{
+    int n = (int)simOptionInt("heat-threads", 1);
+    if (n <= 0)
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0)
+        n = 1;
+
+    const char *active = simOption("heat-active");
+    const char *tile = simOption("heat-tile");
+    if (active && *active && strcmp(active, "0") != 0)
+    {
+        if (sscanf(active, "%dx%d", &Active.tileW, &Active.tileH) != 2 || Active.tileW <= 0 || Active.tileH <= 0)
+        {
+            Active.tileW = 128;
+            Active.tileH = 16;
+        }
+        fprintf(stderr, "heat: %dx%d active tiles%s\n", Active.tileW, Active.tileH,
+                tile && *tile && strcmp(tile, "0") != 0 ? ", HEAT_TILE ignored" : "");
+    }
+    else if (tile && *tile && strcmp(tile, "0") != 0)
+    {
+        /* по умолчанию 256x64: два буфера тайла с ореолом - около 150 КБ, влезают в L2 */
+        if (sscanf(tile, "%dx%d", &Pool.tileW, &Pool.tileH) != 2 || Pool.tileW <= 0 || Pool.tileH <= 0)
+        {
+            Pool.tileW = 256;
+            Pool.tileH = 64;
+        }
+        Pool.fuse = (int)simOptionInt("heat-fuse", 0);
+        if (Pool.fuse > 0)
+            fprintf(stderr, "heat: %dx%d tiles, %d steps per pass\n", Pool.tileW, Pool.tileH, Pool.fuse);
+        else
+            fprintf(stderr, "heat: %dx%d tiles, all steps of a frame per pass\n", Pool.tileW, Pool.tileH);
+    }
+
+    Pool.bands = aligned_alloc(64, sizeof(Band) * (size_t)n);
+    Pool.stats = aligned_alloc(64, sizeof(WorkerStat) * (size_t)n);
+    memset(Pool.stats, 0, sizeof(WorkerStat) * (size_t)n);
+    for (int t = 0; t < n; ++t)
+        atomic_init(&Pool.bands[t].next, 0);
+    Pool.tid = calloc((size_t)n, sizeof(pthread_t));
+    Pool.threads = n;
+    for (int t = 1; t < n; ++t)
+    {
+        if (pthread_create(&Pool.tid[t], NULL, workerMain, (void *)(intptr_t)t) != 0)
+        {
+            perror("heat: worker thread");
+            exit(1);
+        }
+    }
+    atexit(poolReport);
+}
+
+int heatThreads(void)
+{
+    if (Pool.threads == 0)
+        poolInit();
+    return Pool.threads;
+}
+
+/* Карта под сетку g: поначалу все тайлы считаются ненулевыми в обоих буферах */
+static void activeInit(const HeatGrid *g)
+{
+    if (Active.key == g->buf[0] && Active.tilesX == (g->w + Active.tileW - 1) / Active.tileW &&
+        Active.tilesY == (g->h + Active.tileH - 1) / Active.tileH)
+        return;
+    for (int b = 0; b < 2; ++b)
+    {
+        free(Active.hot[b]);
+        free(Active.list[b]);
+    }
+    free(Active.work);
+    free(Active.result);
+    free(Active.mark);
+    Active.key = g->buf[0];
+    Active.tilesX = (g->w + Active.tileW - 1) / Active.tileW;
+    Active.tilesY = (g->h + Active.tileH - 1) / Active.tileH;
+    size_t n = (size_t)Active.tilesX * Active.tilesY;
+    for (int b = 0; b < 2; ++b)
+    {
+        Active.hot[b] = calloc(n, 1);
+        Active.list[b] = malloc(n * sizeof(int));
+        Active.count[b] = 0;
+    }
+    Active.work = malloc(n * sizeof(int));
+    Active.result = malloc(n);
+    Active.mark = calloc(n, sizeof(unsigned));
+    if (!Active.hot[0] || !Active.hot[1] || !Active.list[0] || !Active.list[1] ||
+        !Active.work || !Active.result || !Active.mark)
+    {
+        perror("heat: active tiles");
+        exit(1);
+    }
+    for (int t = 0; t < (int)n; ++t)
+    {
+        markHot(0, t);
+        markHot(1, t);
+    }
+}
+
+int heatSteps(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling)
+{
+    const int w = g->w, h = g->h;
+    static int adi = -1;
+    if (adi < 0)
+    {
+        const char *solver = simOption("heat-solver");
+        adi = solver && strcmp(solver, "adi") == 0;
+        if (solver && *solver && !adi && strcmp(solver, "explicit") != 0)
+        {
+            fprintf(stderr, "heat: unknown solver '%s' (explicit or adi)\n", solver);
+            exit(1);
+        }
+    }
+    if (adi)
+        return heatAdiSteps(g, ping, src, steps, cooling);
+    int slab = heatSlabSteps(g, ping, src, steps, cooling);
+    if (slab >= 0)
+        return slab;
+    if (Pool.threads == 0)
+        poolInit();
+    uint64_t t0 = nanos();
+
+    int active = Active.tileW > 0;
+    int tilesX = !active && Pool.tileW > 0 ? (w + Pool.tileW - 1) / Pool.tileW : 0;
+    if (active)
+        activeInit(g);
+    else
+        setBands(tilesX > 0 ? tilesX * ((h + Pool.tileH - 1) / Pool.tileH) : h, tilesX > 0);
+    resetBands();
+
+    HeatSources binned;
+    if (src && src->n > 0)
+    {
+        heatBinSources(&Bins, src, w, h);
+        binned = *src;
+        binned.bins = &Bins;
+        src = &binned;
+    }
+
+    Job j = { *g, ping, src, steps, cooling, tilesX, active };
+    if (Pool.threads > 1)
+    {
+        pthread_mutex_lock(&Pool.lock);
+        Pool.job = j;
+        ++Pool.generation;
+        pthread_cond_broadcast(&Pool.wake);
+        pthread_mutex_unlock(&Pool.lock);
+    }
+    /* последний барьер job'а гарантирует, что все полосы досчитаны */
+    runJob(0, j);
+
+    Pool.wall += nanos() - t0;
+    ++Pool.jobs;
+    Pool.cellSteps += (uint64_t)w * h * (uint64_t)steps;
+    Pool.elem = g->elem;
+    if (tilesX > 0)
+    {
+        /* каждый слитый проход пишет во второй буфер */
+        int k = Pool.fuse > 0 && Pool.fuse < steps ? Pool.fuse : steps;
+        return ((steps + k - 1) / k) & 1 ? ping ^ 1 : ping;
+    }
+    return steps & 1 ? ping ^ 1 : ping;
+}
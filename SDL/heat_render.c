@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "heat.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Вывод сетки прямо в кадр sim.c. За кадр строка сетки сравнивается с
+ * теневой копией показанных температур (байты), различия собираются в
+ * битовую карту строки, и перерисовываются только серии изменившихся клеток:
+ * палитра даёт цвет, клетка растягивается на scale пикселей, первая строка
+ * пикселей копируется ещё scale-1 раз. Полосы соседних грязных строк
+ * отмечаются через simMarkDirty, так что sim.c грузит в текстуру только их.
+ */
+
+void heatViewInit(HeatView *v, const HeatGrid *g, int scale, const int *palette)
+{
+    v->scale = scale;
+    v->palette = palette;
+    v->w = g->w < (SIM_X_SIZE + scale - 1) / scale ? g->w : (SIM_X_SIZE + scale - 1) / scale;
+    v->h = g->h < (SIM_Y_SIZE + scale - 1) / scale ? g->h : (SIM_Y_SIZE + scale - 1) / scale;
+    v->shadow = malloc((size_t)v->w * v->h);
+    v->bits = malloc(sizeof(unsigned long long) * (size_t)((v->w + 63) / 64));
+    if (!v->shadow || !v->bits)
+    {
+        perror("heat: view");
+        exit(1);
+    }
+    v->full = 1;
+}
+
+/* Температура клетки в байт (в хранилище int она уже в 0..255, но обрезаем) */
+static inline unsigned char cellByte(const HeatGrid *g, const void *row, int x)
+{
+    if (g->elem == 1)
+        return ((const unsigned char *)row)[x];
+    int t = ((const int *)row)[x];
+    return (unsigned char)(t < 0 ? 0 : t > 255 ? 255 : t);
+}
+
+/* Биты изменившихся клеток строки; shadow обновляется до текущих значений */
+static int rowDiff(const HeatGrid *g, const void *row, unsigned char *shadow,
+                   unsigned long long *bits, int w)
+{
+    int dirty = 0;
+    for (int x0 = 0; x0 < w; x0 += 64)
+    {
+        unsigned long long m = 0;
+        int n = w - x0 < 64 ? w - x0 : 64, i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i now;
+            if (g->elem == 1)
+            {
+                now = _mm_loadu_si128((const __m128i *)((const unsigned char *)row + x0 + i));
+            }
+            else
+            {
+                const __m128i *p = (const __m128i *)((const int *)row + x0 + i);
+                now = _mm_packus_epi16(_mm_packs_epi32(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                       _mm_packs_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+            }
+            __m128i old = _mm_loadu_si128((const __m128i *)(shadow + x0 + i));
+            unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(now, old)) & 0xFFFFu;
+            m |= (unsigned long long)diff << i;
+            _mm_storeu_si128((__m128i *)(shadow + x0 + i), now);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            unsigned char now = cellByte(g, row, x0 + i);
+            m |= (unsigned long long)(now != shadow[x0 + i]) << i;
+            shadow[x0 + i] = now;
+        }
+        bits[x0 / 64] = m;
+        dirty |= m != 0;
+    }
+    return dirty;
+}
+
+/* Клетки [a, b) строки gy: цвет по палитре, растяжение на scale x scale */
+static void drawRun(const HeatView *v, uint32_t *fb, const unsigned char *shadow, int gy, int a, int b)
+{
+    const int scale = v->scale;
+    int px0 = a * scale, px1 = b * scale < SIM_X_SIZE ? b * scale : SIM_X_SIZE;
+    int py0 = gy * scale, py1 = py0 + scale < SIM_Y_SIZE ? py0 + scale : SIM_Y_SIZE;
+    uint32_t *row = fb + (size_t)py0 * SIM_X_SIZE;
+    for (int gx = a, x = px0; x < px1; ++gx)
+    {
+        uint32_t color = (uint32_t)v->palette[shadow[gx]];
+        for (int k = 0; k < scale && x < px1; ++k)
+            row[x++] = color;
+    }
+    for (int py = py0 + 1; py < py1; ++py)
+        memcpy(fb + (size_t)py * SIM_X_SIZE + px0, row + px0, (size_t)(px1 - px0) * sizeof(uint32_t));
+}
+
+void heatRender(HeatView *v, const HeatGrid *g, int ping)
+{
+    uint32_t *fb = (uint32_t *)simFramebuffer();
+    const size_t pitch = (size_t)g->stride * g->elem;
+    const int words = (v->w + 63) / 64, scale = v->scale;
+    int bandY0 = -1, bandX0 = 0, bandX1 = 0;
+
+    for (int gy = 0; gy <= v->h; ++gy)
+    {
+        int dirty = 0, lo = v->w, hi = 0;
+        if (gy < v->h)
+        {
+            unsigned char *shadow = v->shadow + (size_t)gy * v->w;
+            dirty = rowDiff(g, (const char *)g->buf[ping] + gy * pitch, shadow, v->bits, v->w);
+            if (v->full)
+            {
+                for (int k = 0; k < words; ++k)
+                    v->bits[k] = ~0ull;
+                if (v->w % 64)
+                    v->bits[words - 1] = (1ull << (v->w % 64)) - 1;
+                dirty = 1;
+            }
+            /* серии единиц битовой карты */
+            for (int k = 0; k < words && dirty; ++k)
+            {
+                unsigned long long m = v->bits[k];
+                while (m)
+                {
+                    int a = k * 64 + __builtin_ctzll(m);
+                    unsigned long long rest = ~(m | ((1ull << (a - k * 64)) - 1));
+                    int b = rest ? k * 64 + __builtin_ctzll(rest) : (k + 1) * 64;
+                    if (b > v->w)
+                        b = v->w;
+                    /* серия может продолжаться в следующем слове */
+                    while (b == (k + 1) * 64 && k + 1 < words && (v->bits[k + 1] & 1))
+                    {
+                        ++k;
+                        unsigned long long next = ~v->bits[k];
+                        b = next ? k * 64 + __builtin_ctzll(next) : (k + 1) * 64;
+                        if (b > v->w)
+                            b = v->w;
+                        m = v->bits[k];
+                    }
+                    drawRun(v, fb, shadow, gy, a, b);
+                    if (a < lo) lo = a;
+                    if (b > hi) hi = b;
+                    int cut = b - k * 64;
+                    m = cut >= 64 ? 0 : m & ~((1ull << cut) - 1);
+                }
+            }
+        }
+        /* полоса соседних грязных строк - один прямоугольник для sim.c */
+        if (dirty && bandY0 >= 0)
+        {
+            if (lo < bandX0) bandX0 = lo;
+            if (hi > bandX1) bandX1 = hi;
+            continue;
+        }
+        if (bandY0 >= 0)
+            simMarkDirty(bandX0 * scale, bandY0 * scale, (bandX1 - bandX0) * scale, (gy - bandY0) * scale);
+        bandY0 = dirty ? gy : -1;
+        bandX0 = lo;
+        bandX1 = hi;
+    }
+    v->full = 0;
+}
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "heat.h"
+#include "sim.h"
+
+/*
+ * Многопроцессный режим (HEAT_PROCS=N, N > 1): сетка режется на N
+ * горизонтальных полос, каждой владеет свой процесс-рабочий. Рабочий
+ * закрепляется за узлом NUMA (узел k % число узлов, список ядер из
+ * /sys/devices/system/node/nodeK/cpulist) и сам первым трогает память своей
+ * полосы, так что она оказывается на его узле.
+ *
+ * Граничные строки ходят между соседями через кольца в общей памяти
+ * (shm_open): у каждой границы два кольца (вниз и вверх) по RING_SLOTS строк,
+ * ожидание - спин, затем futex. Это локальная замена межузлового транспорта
+ * в духе MPI: рабочим нужен только свой кусок и соседские строки.
+ *
+ * Координатор - процесс приложения: heatSteps кладёт источники и команду в
+ * общую память, рабочие считают шаги и выкладывают полосы в общий буфер
+ * сборки, координатор копирует его в g->buf[] для вывода. Сетка после
+ * первого вызова принадлежит рабочим: запись приложения в неё не видна.
+ */
+
+#define RING_SLOTS 4
+#define SPINS_BEFORE_WAIT 512
+
+typedef struct
+{
+    _Alignas(64) atomic_uint head;    /* записано строк */
+    atomic_uint headWaiters;
+    _Alignas(64) atomic_uint tail;    /* прочитано строк */
+    atomic_uint tailWaiters;
+    char *slots;                      /* RING_SLOTS строк по rowBytes */
+} Ring;
+
+typedef struct
+{
+    _Alignas(64) uint64_t haloWaits;  /* ожиданий соседской строки или места в кольце */
+    uint64_t steps;
+    int node;
+} SlabStat;
+
+typedef struct
+{
+    _Alignas(64) atomic_uint seq;     /* номер команды */
+    atomic_uint seqWaiters;
+    int steps;                        /* < 0 - завершиться */
+    int cooling;
+    int nsrc;
+    _Alignas(64) atomic_uint done;    /* выполнено команд, в сумме по рабочим */
+    atomic_uint doneWaiters;
+} Control;
+
+static struct
+{
+    int procs;                        /* 0 - ещё не читали HEAT_PROCS, 1 - режим выключен */
+    int w, h, stride, elem;
+    size_t rowBytes, pitch;
+    int srcCap;
+    Control *ctl;
+    int *srcData;                     /* x, y, r, t по srcCap */
+    Ring *down, *up;                  /* down[k]: k -> k+1 (последняя строка k), up[k]: k+1 -> k */
+    char *gather;                     /* h строк по pitch */
+    SlabStat *stats;
+    pid_t *pid;
+    unsigned commands;
+} Slab;
+
+static long futex(atomic_uint *addr, int op, unsigned val)
+{
+    return syscall(SYS_futex, (unsigned *)addr, op, val, NULL, NULL, 0);
+}
+
+/* Ждёт, пока *word == val; waiters сообщает публикующему, что нужен FUTEX_WAKE */
+static int waitWhile(atomic_uint *word, unsigned val, atomic_uint *waiters)
+{
+    for (int spin = 0; spin < SPINS_BEFORE_WAIT; ++spin)
+        if (atomic_load(word) != val)
+            return 0;
+    atomic_fetch_add(waiters, 1);
+    while (atomic_load(word) == val)
+        futex(word, FUTEX_WAIT, val);
+    atomic_fetch_sub(waiters, 1);
+    return 1;
+}
+
+static void publish(atomic_uint *word, unsigned val, atomic_uint *waiters)
+{
+    atomic_store(word, val);
+    if (atomic_load(waiters))
+        futex(word, FUTEX_WAKE, INT_MAX);
+}
+
+static void ringSend(Ring *r, const void *row, SlabStat *st)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail;
+    while (head - (tail = atomic_load(&r->tail)) == RING_SLOTS)
+        st->haloWaits += waitWhile(&r->tail, tail, &r->tailWaiters);
+    memcpy(r->slots + (size_t)(head % RING_SLOTS) * Slab.rowBytes, row, Slab.rowBytes);
+    publish(&r->head, head + 1, &r->headWaiters);
+}
+
+static void ringRecv(Ring *r, void *row, SlabStat *st)
+{
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head;
+    while ((head = atomic_load(&r->head)) == tail)
+        st->haloWaits += waitWhile(&r->head, head, &r->headWaiters);
+    memcpy(row, r->slots + (size_t)(tail % RING_SLOTS) * Slab.rowBytes, Slab.rowBytes);
+    publish(&r->tail, tail + 1, &r->tailWaiters);
+}
+
+/* Узлов NUMA в /sys (0, если сведений нет) */
+static int numaNodes(void)
+{
+    int n = 0;
+    char path[64];
+    for (;; ++n)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (access(path, F_OK) != 0)
+            return n;
+    }
+}
+
+/* Закрепление за ядрами узла node по его cpulist ("0-3,8-11") */
+static void pinToNode(int node)
+{
+    char path[80], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return;
+    if (!fgets(list, sizeof(list), f))
+        list[0] = '\0';
+    fclose(f);
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (char *p = list; *p && *p != '\n'; )
+    {
+        int a = (int)strtol(p, &p, 10), b = a;
+        if (*p == '-')
+            b = (int)strtol(p + 1, &p, 10);
+        for (int c = a; c <= b && c < CPU_SETSIZE; ++c)
+            CPU_SET(c, &set);
+        if (*p == ',')
+            ++p;
+        else if (*p && *p != '\n')
+            break;
+    }
+    if (CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) != 0)
+        perror("heat: sched_setaffinity");
+}
+
+static void workerMain(int k, const HeatGrid *init, int ping)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    SlabStat *st = &Slab.stats[k];
+    int nodes = numaNodes();
+    st->node = nodes > 0 ? k % nodes : -1;
+    if (nodes > 0)
+        pinToNode(st->node);
+
+    const int y0 = (int)((long long)Slab.h * k / Slab.procs);
+    const int y1 = (int)((long long)Slab.h * (k + 1) / Slab.procs);
+    const int ra = y0 > 0 ? y0 - 1 : 0, rb = y1 < Slab.h ? y1 + 1 : Slab.h;
+
+    /* буферы на всю сетку, но страницы появляются только под строками полосы
+       и ореола - при первой записи, уже на узле рабочего */
+    size_t bytes = Slab.pitch * Slab.h;
+    HeatGrid g = { Slab.w, Slab.h, Slab.stride, Slab.elem, { NULL, NULL } };
+    for (int b = 0; b < 2; ++b)
+    {
+        g.buf[b] = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (g.buf[b] == MAP_FAILED)
+        {
+            perror("heat: slab mmap");
+            _exit(1);
+        }
+    }
+    int p = 0;
+    memcpy((char *)g.buf[p] + ra * Slab.pitch, (const char *)init->buf[ping] + ra * Slab.pitch,
+           (size_t)(rb - ra) * Slab.pitch);
+    memset((char *)g.buf[p ^ 1] + ra * Slab.pitch, 0, (size_t)(rb - ra) * Slab.pitch);
+
+    /* свои граничные строки - соседям заранее: каждый шаг начинается с приёма */
+    if (k > 0)
+        ringSend(&Slab.up[k - 1], (char *)g.buf[p] + y0 * Slab.pitch, st);
+    if (k < Slab.procs - 1)
+        ringSend(&Slab.down[k], (char *)g.buf[p] + (y1 - 1) * Slab.pitch, st);
+
+    HeatBins bins = { 0 };
+    for (unsigned seen = 0;;)
+    {
+        unsigned seq;
+        while ((seq = atomic_load(&Slab.ctl->seq)) == seen)
+            waitWhile(&Slab.ctl->seq, seq, &Slab.ctl->seqWaiters);
+        seen = seq;
+        if (Slab.ctl->steps < 0)
+            _exit(0);
+
+        int n = Slab.ctl->nsrc;
+        HeatSources src = { Slab.srcData, Slab.srcData + Slab.srcCap, Slab.srcData + 2 * Slab.srcCap,
+                            Slab.srcData + 3 * Slab.srcCap, n, NULL };
+        if (n > 0)
+        {
+            heatBinSources(&bins, &src, Slab.w, Slab.h);
+            src.bins = &bins;
+        }
+        for (int s = 0; s < Slab.ctl->steps; ++s)
+        {
+            if (k > 0)
+                ringRecv(&Slab.down[k - 1], (char *)g.buf[p] + (y0 - 1) * Slab.pitch, st);
+            if (k < Slab.procs - 1)
+                ringRecv(&Slab.up[k], (char *)g.buf[p] + y1 * Slab.pitch, st);
+            /* подогрев и ореола: источники у всех одни, результат совпадёт с соседским */
+            if (n > 0)
+                heatApplySources(&g, p, &src, ra, rb);
+            heatDiffuseRows(&g, p, Slab.ctl->cooling, y0, y1);
+            p ^= 1;
+            if (k > 0)
+                ringSend(&Slab.up[k - 1], (char *)g.buf[p] + y0 * Slab.pitch, st);
+            if (k < Slab.procs - 1)
+                ringSend(&Slab.down[k], (char *)g.buf[p] + (y1 - 1) * Slab.pitch, st);
+            ++st->steps;
+        }
+        memcpy(Slab.gather + y0 * Slab.pitch, (char *)g.buf[p] + y0 * Slab.pitch,
+               (size_t)(y1 - y0) * Slab.pitch);
+        atomic_fetch_add(&Slab.ctl->done, 1);
+        if (atomic_load(&Slab.ctl->doneWaiters))
+            futex(&Slab.ctl->done, FUTEX_WAKE, INT_MAX);
+    }
+}
+
+static void slabShutdown(void)
+{
+    Slab.ctl->steps = -1;
+    publish(&Slab.ctl->seq, atomic_load(&Slab.ctl->seq) + 1, &Slab.ctl->seqWaiters);
+    for (int k = 0; k < Slab.procs; ++k)
+        waitpid(Slab.pid[k], NULL, 0);
+    fprintf(stderr, "heat: %d slab processes, %u commands\n", Slab.procs, Slab.commands);
+    for (int k = 0; k < Slab.procs; ++k)
+    {
+        const SlabStat *st = &Slab.stats[k];
+        fprintf(stderr, "heat:   slab %2d rows %d..%d node %d  steps %llu  halo waits %llu\n", k,
+                (int)((long long)Slab.h * k / Slab.procs), (int)((long long)Slab.h * (k + 1) / Slab.procs) - 1,
+                st->node, (unsigned long long)st->steps, (unsigned long long)st->haloWaits);
+    }
+}
+
+static void *carve(char **at, size_t bytes)
+{
+    void *p = *at;
+    *at += (bytes + 63) & ~(size_t)63;
+    return p;
+}
+
+/* Общая память и рабочие - при первом вызове, состояние сетки - из g->buf[ping] */
+static void slabStart(const HeatGrid *g, int ping, const HeatSources *src)
+{
+    if (Slab.procs > g->h)
+        Slab.procs = g->h;
+    Slab.w = g->w;
+    Slab.h = g->h;
+    Slab.stride = g->stride;
+    Slab.elem = g->elem;
+    Slab.rowBytes = (size_t)g->w * g->elem;
+    Slab.pitch = (size_t)g->stride * g->elem;
+    Slab.srcCap = src && src->n > 16 ? src->n : 16;
+
+    const int P = Slab.procs;
+    size_t rings = (size_t)(P - 1) * 2;
+    size_t size = 64 * (3 + rings + (size_t)P) + sizeof(Control) + 4 * (size_t)Slab.srcCap * sizeof(int) +
+                  rings * (sizeof(Ring) + RING_SLOTS * Slab.rowBytes) + Slab.pitch * Slab.h +
+                  (size_t)P * sizeof(SlabStat);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/heat-slab-%d", (int)getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0)
+    {
+        perror("heat: shm_open");
+        exit(1);
+    }
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        perror("heat: shm mmap");
+        exit(1);
+    }
+    /* отображение наследуется рабочими через fork, имя больше не нужно */
+    close(fd);
+    shm_unlink(name);
+
+    char *at = base;
+    Slab.ctl = carve(&at, sizeof(Control));
+    Slab.srcData = carve(&at, 4 * (size_t)Slab.srcCap * sizeof(int));
+    Slab.down = carve(&at, (size_t)(P - 1) * sizeof(Ring));
+    Slab.up = carve(&at, (size_t)(P - 1) * sizeof(Ring));
+    for (int k = 0; k < P - 1; ++k)
+    {
+        Slab.down[k].slots = carve(&at, RING_SLOTS * Slab.rowBytes);
+        Slab.up[k].slots = carve(&at, RING_SLOTS * Slab.rowBytes);
+    }
+    Slab.gather = carve(&at, Slab.pitch * Slab.h);
+    Slab.stats = carve(&at, (size_t)P * sizeof(SlabStat));
+    Slab.pid = calloc((size_t)P, sizeof(pid_t));
+
+    fprintf(stderr, "heat: %d slab processes, %d NUMA nodes\n", P, numaNodes());
+    fflush(NULL);
+    for (int k = 0; k < P; ++k)
+    {
+        Slab.pid[k] = fork();
+        if (Slab.pid[k] < 0)
+        {
+            perror("heat: fork");
+            exit(1);
+        }
+        if (Slab.pid[k] == 0)
+            workerMain(k, g, ping);
+    }
+    atexit(slabShutdown);
+}
+
+int heatSlabSteps(const HeatGrid *g, int ping, const HeatSources *src, int steps, int cooling)
+{
+    if (Slab.procs == 0)
+    {
+        long long n = simOptionInt("heat-procs", 1);
+        Slab.procs = n > 1 ? (int)n : 1;
+    }
+    if (Slab.procs <= 1)
+        return -1;
+    if (!Slab.ctl)
+        slabStart(g, ping, src);
+    if (g->w != Slab.w || g->h != Slab.h || g->stride != Slab.stride || g->elem != Slab.elem)
+    {
+        fprintf(stderr, "heat: slab processes are bound to a %dx%d grid\n", Slab.w, Slab.h);
+        exit(1);
+    }
+
+    int n = src ? src->n : 0;
+    if (n > Slab.srcCap)
+    {
+        fprintf(stderr, "heat: %d sources, slab processes were started for %d\n", n, Slab.srcCap);
+        exit(1);
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        Slab.srcData[i] = src->x[i];
+        Slab.srcData[Slab.srcCap + i] = src->y[i];
+        Slab.srcData[2 * Slab.srcCap + i] = src->r[i];
+        Slab.srcData[3 * Slab.srcCap + i] = src->t[i];
+    }
+    Slab.ctl->nsrc = n;
+    Slab.ctl->steps = steps;
+    Slab.ctl->cooling = cooling;
+    ++Slab.commands;
+    publish(&Slab.ctl->seq, Slab.commands, &Slab.ctl->seqWaiters);
+
+    unsigned target = Slab.commands * (unsigned)Slab.procs, done;
+    while ((done = atomic_load(&Slab.ctl->done)) != target)
+        waitWhile(&Slab.ctl->done, done, &Slab.ctl->doneWaiters);
+
+    int result = steps & 1 ? ping ^ 1 : ping;
+    memcpy(g->buf[result], Slab.gather, Slab.pitch * Slab.h);
+    return result;
+}
@@ -1,65 +1,1101 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 #include <assert.h>
-#include <SDL2/SDL.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#ifndef SIM_HEADLESS
+#include <SDL2/SDL.h>
+#endif
 #include "sim.h"
 
 #define FRAME_TICKS 50
+#define VIDEO_CHUNK_FRAMES 64
+#define TELEMETRY_FRAMES 4096
+#define DIRTY_RECTS 16
 
+/*
+ * Бэкенды:
+ *  - SDL (по умолчанию): окно + streaming-текстура;
+ *  - headless: без окна, кадры дописываются в mmap-файл SIM_VIDEO.
+ * Headless выбирается при сборке (-DSIM_HEADLESS, тогда SDL не нужен вовсе)
+ * или при запуске переменной окружения SIM_HEADLESS=1.
+ * SIM_FRAMES=N завершает программу после N кадров в любом бэкенде.
+ * SIM_BENCH=1 отключает выдержку FRAME_TICKS (кадры идут без ограничения).
+ * SIM_SEED=N фиксирует зерно simRand (иначе берётся time(NULL)).
+ * Любую из этих настроек можно задать и ключом командной строки:
+ * --sim-frames=N и т.д. (см. simOption).
+ */
+#ifdef SIM_HEADLESS
+static int Headless = 1;
+#else
+static int Headless = 0;
 static SDL_Renderer *Renderer = NULL;
 static SDL_Window *Window = NULL;
-static Uint32 Ticks = 0;
+static SDL_Texture *Texture = NULL;
 
-void simInit()
+/*
+ * Вывод идёт в отдельном потоке (он же владеет окном и событиями SDL).
+ * simFlush копирует кадр в свободный из трёх буферов и публикует его одним
+ * atomic_exchange: Back - пишет simFlush, Ready - последний опубликованный
+ * (с флагом READY_FRESH, пока его не забрали), Front - выводится сейчас.
+ * Пока поток вывода грузит текстуру и ждёт vsync, приложение считает дальше.
+ */
+#define READY_FRESH 4u
+enum { PRESENTER_STARTING, PRESENTER_RUNNING, PRESENTER_STOP };
+
+static uint32_t Present[3][SIM_Y_SIZE][SIM_X_SIZE];
+static unsigned Back = 0;
+static atomic_uint Ready = 1;
+static unsigned Front = 2;
+static pthread_t Presenter;
+static atomic_int PresenterState = PRESENTER_STARTING;
+static atomic_int QuitRequested = 0;
+static atomic_uint_fast64_t Presented = 0;
+#endif
+static long Frames = 0;
+static long FrameLimit = 0;
+static int Bench = 0;
+
+/* Кадр целиком живёт в памяти (ARGB8888) и выгружается в текстуру раз за simFlush */
+static uint32_t Framebuffer[SIM_Y_SIZE][SIM_X_SIZE];
+
+/*
+ * Грязные прямоугольники: что изменилось в Framebuffer за кадр. Функции
+ * рисования отмечают их сами, прямая запись через simFramebuffer - вызовом
+ * simMarkDirty. Пересекающиеся и соседние прямоугольники сливаются, при
+ * переполнении новый вливается в тот, чья площадь растёт меньше всего.
+ * В буфер вывода копируется и в текстуру грузится только отмеченное.
+ */
+typedef struct
+{
+    int x0, y0, x1, y1;
+} DirtyRect;
+
+typedef struct
+{
+    int n;
+    DirtyRect r[DIRTY_RECTS];
+} DirtySet;
+
+static DirtySet FrameDirty;
+#ifndef SIM_HEADLESS
+/* SlotDirty[b] - что изменилось с последней записи Present[b]; Unshown - что
+   ещё не выгружено в текстуру с последнего забранного кадра (оба пишет только
+   simFlush). PublishDirty[b] - грязные области, опубликованные вместе с
+   Present[b]: их пишет владелец Back, а читает поток вывода, забрав Front */
+static DirtySet SlotDirty[3];
+static DirtySet Unshown;
+static DirtySet PublishDirty[3];
+#endif
+
+/*
+ * Телеметрия кадров: одна запись на simFlush. Кольцо пишет только поток,
+ * вызывающий simFlush, читатель видит записи до Head (release/acquire),
+ * поэтому блокировки не нужны. Хранятся последние TELEMETRY_FRAMES кадров.
+ */
+typedef struct
+{
+    uint64_t compute; /* нс от конца прошлого simFlush до начала текущего */
+    uint64_t present; /* нс на выгрузку/запись кадра (без выдержки FRAME_TICKS) */
+    uint64_t wall;    /* нс между концами соседних simFlush */
+    uint64_t calls;   /* вызовов simPutPixel и пакетных функций */
+    uint64_t pixels;  /* записанных пикселей */
+    uint64_t cells;   /* логических ячеек-шагов, см. simAddCells */
+    uint64_t dirty;   /* пикселей в грязных прямоугольниках кадра */
+} FrameStat;
+
+static FrameStat Telemetry[TELEMETRY_FRAMES];
+static atomic_uint_fast64_t TelemetryHead;
+static FrameStat Frame;
+static uint64_t FrameStart = 0;
+static uint64_t TotalCompute = 0, TotalWall = 0, TotalCells = 0, TotalDirty = 0;
+
+/*
+ * Генератор: xoshiro256** с засевом через splitmix64. У каждого потока своё
+ * состояние; поток k получает состояние потока 0, прыгнувшее k раз на 2^128,
+ * так что последовательности разных потоков не перекрываются. Поток 0 - тот,
+ * кто вызвал simInit; остальные нумеруются по первому обращению либо явно
+ * через simRandStream. simSeed перезасевает все потоки (через поколение).
+ */
+typedef struct
+{
+    uint64_t s[4];
+    uint64_t gen;
+    unsigned stream;
+    int hasStream;
+} RandState;
+
+static uint64_t Seed = 0;
+static atomic_uint_fast64_t SeedGen = 1;
+static atomic_uint NextStream = 1;
+static _Thread_local RandState Rand;
+
+enum { VIDEO_ARGB, VIDEO_Y4M };
+
+/* Видеофайл: заранее выделенный и отображённый в память, кадры пишутся подряд */
+static struct
+{
+    int fd;
+    int format;
+    uint8_t *map;
+    size_t size;
+    size_t used;
+    size_t frameBytes;
+} Video = { -1, VIDEO_ARGB, NULL, 0, 0, 0 };
+
+static DirtyRect rectUnion(DirtyRect a, DirtyRect b)
+{
+    DirtyRect u = { a.x0 < b.x0 ? a.x0 : b.x0, a.y0 < b.y0 ? a.y0 : b.y0,
+                    a.x1 > b.x1 ? a.x1 : b.x1, a.y1 > b.y1 ? a.y1 : b.y1 };
+    return u;
+}
+
+static long long rectArea(DirtyRect a)
+{
+    return (long long)(a.x1 - a.x0) * (a.y1 - a.y0);
+}
+
+static void dirtyAdd(DirtySet *set, DirtyRect r)
+{
+    for (;;)
+    {
+        /* касающиеся прямоугольники сливаются, пока объединение что-то задевает */
+        int k = 0;
+        while (k < set->n && (r.x0 > set->r[k].x1 || set->r[k].x0 > r.x1 ||
+                              r.y0 > set->r[k].y1 || set->r[k].y0 > r.y1))
+            ++k;
+        if (k == set->n)
+            break;
+        r = rectUnion(r, set->r[k]);
+        set->r[k] = set->r[--set->n];
+    }
+    if (set->n == DIRTY_RECTS)
+    {
+        int best = 0;
+        long long bestGrowth = -1;
+        for (int k = 0; k < set->n; ++k)
+        {
+            long long growth = rectArea(rectUnion(r, set->r[k])) - rectArea(set->r[k]);
+            if (bestGrowth < 0 || growth < bestGrowth)
+            {
+                best = k;
+                bestGrowth = growth;
+            }
+        }
+        r = rectUnion(r, set->r[best]);
+        set->r[best] = set->r[--set->n];
+        dirtyAdd(set, r);
+        return;
+    }
+    set->r[set->n++] = r;
+}
+
+#ifndef SIM_HEADLESS
+static void dirtyMerge(DirtySet *dst, const DirtySet *src)
+{
+    for (int k = 0; k < src->n; ++k)
+        dirtyAdd(dst, src->r[k]);
+}
+#endif
+
+static uint64_t dirtyArea(const DirtySet *set)
+{
+    uint64_t area = 0;
+    for (int k = 0; k < set->n; ++k)
+        area += (uint64_t)rectArea(set->r[k]);
+    return area;
+}
+
+static void markDirty(int x, int y, int w, int h)
+{
+    DirtyRect r = { x, y, x + w, y + h };
+    dirtyAdd(&FrameDirty, r);
+}
+
+static uint64_t simNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int ArgCount = 0;
+static char **Args = NULL;
+
+void simArgs(int argc, char **argv)
+{
+    ArgCount = argc;
+    Args = argv;
+}
+
+const char *simOption(const char *name)
+{
+    size_t len = strlen(name);
+    for (int i = 1; i < ArgCount; ++i)
+    {
+        const char *a = Args[i];
+        if (a[0] == '-' && a[1] == '-' && strncmp(a + 2, name, len) == 0 && a[2 + len] == '=')
+            return a + 3 + len;
+    }
+    char env[64];
+    size_t i = 0;
+    for (; name[i] && i + 1 < sizeof(env); ++i)
+        env[i] = name[i] == '-' ? '_' : (char)(name[i] >= 'a' && name[i] <= 'z' ? name[i] - 32 : name[i]);
+    env[i] = 0;
+    return getenv(env);
+}
+
+long long simOptionInt(const char *name, long long def)
+{
+    const char *v = simOption(name);
+    return v && *v ? strtoll(v, NULL, 0) : def;
+}
+
+static int envFlag(const char *name)
+{
+    const char *v = simOption(name);
+    return v && *v && strcmp(v, "0") != 0;
+}
+
+static void videoReserve(size_t bytes)
+{
+    if (Video.used + bytes <= Video.size)
+        return;
+    size_t size = Video.size ? Video.size : bytes;
+    while (size < Video.used + bytes)
+        size += VIDEO_CHUNK_FRAMES * Video.frameBytes;
+    if (ftruncate(Video.fd, (off_t)size) != 0)
+    {
+        perror("sim: ftruncate");
+        exit(1);
+    }
+    if (Video.map)
+        munmap(Video.map, Video.size);
+    Video.map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, Video.fd, 0);
+    if (Video.map == MAP_FAILED)
+    {
+        perror("sim: mmap");
+        exit(1);
+    }
+    Video.size = size;
+}
+
+static void videoOpen(const char *path)
 {
+    const char *fmt = simOption("sim-video-format");
+    size_t len = strlen(path);
+    if (fmt ? strcmp(fmt, "y4m") == 0 : (len > 4 && strcmp(path + len - 4, ".y4m") == 0))
+        Video.format = VIDEO_Y4M;
+
+    Video.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (Video.fd < 0)
+    {
+        perror("sim: open SIM_VIDEO");
+        exit(1);
+    }
+
+    char header[128];
+    int headerLen = 0;
+    if (Video.format == VIDEO_Y4M)
+    {
+        /* 4:4:4 без прореживания цвета, чтобы кадры можно было сравнивать побайтно */
+        headerLen = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                             SIM_X_SIZE, SIM_Y_SIZE, 1000 / FRAME_TICKS);
+        Video.frameBytes = 6 + (size_t)SIM_X_SIZE * SIM_Y_SIZE * 3;
+    }
+    else
+    {
+        Video.frameBytes = sizeof(Framebuffer);
+    }
+
+    long frames = FrameLimit ? FrameLimit : VIDEO_CHUNK_FRAMES;
+    videoReserve(headerLen + frames * Video.frameBytes);
+    memcpy(Video.map, header, headerLen);
+    Video.used = headerLen;
+}
+
+static void videoWrite()
+{
+    videoReserve(Video.frameBytes);
+    uint8_t *out = Video.map + Video.used;
+    if (Video.format == VIDEO_ARGB)
+    {
+        memcpy(out, Framebuffer, sizeof(Framebuffer));
+    }
+    else
+    {
+        const size_t plane = (size_t)SIM_X_SIZE * SIM_Y_SIZE;
+        memcpy(out, "FRAME\n", 6);
+        uint8_t *Y = out + 6, *U = Y + plane, *V = U + plane;
+        const uint32_t *p = &Framebuffer[0][0];
+        for (size_t i = 0; i < plane; ++i)
+        {
+            int r = (p[i] >> 16) & 0xFF, g = (p[i] >> 8) & 0xFF, b = p[i] & 0xFF;
+            /* BT.601, студийный диапазон */
+            Y[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            U[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            V[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+    Video.used += Video.frameBytes;
+}
+
+static void videoClose()
+{
+    if (Video.fd < 0)
+        return;
+    munmap(Video.map, Video.size);
+    if (ftruncate(Video.fd, (off_t)Video.used) != 0)
+        perror("sim: ftruncate");
+    close(Video.fd);
+    Video.fd = -1;
+    fprintf(stderr, "sim: %ld frames written\n", Frames);
+}
+
+static void telemetryPush()
+{
+    uint64_t head = atomic_load_explicit(&TelemetryHead, memory_order_relaxed);
+    Telemetry[head % TELEMETRY_FRAMES] = Frame;
+    atomic_store_explicit(&TelemetryHead, head + 1, memory_order_release);
+    TotalCompute += Frame.compute;
+    TotalWall += Frame.wall;
+    TotalCells += Frame.cells;
+    TotalDirty += Frame.dirty;
+    memset(&Frame, 0, sizeof(Frame));
+}
+
+static int cmpU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* p50/p95/p99 одного поля FrameStat (в миллисекундах) по записям кольца */
+static void telemetryPercentiles(size_t field, size_t n, double out[3])
+{
+    static uint64_t v[TELEMETRY_FRAMES];
+    for (size_t i = 0; i < n; ++i)
+        v[i] = *(const uint64_t *)((const char *)&Telemetry[i] + field);
+    qsort(v, n, sizeof(v[0]), cmpU64);
+    static const int pct[3] = { 50, 95, 99 };
+    for (int k = 0; k < 3; ++k)
+        out[k] = v[(n - 1) * pct[k] / 100] / 1e6;
+}
+
+static void telemetryReport()
+{
+    uint64_t head = atomic_load_explicit(&TelemetryHead, memory_order_acquire);
+    size_t n = head < TELEMETRY_FRAMES ? (size_t)head : TELEMETRY_FRAMES;
+    if (n == 0)
+        return;
+
+    const char *dump = simOption("sim-telemetry");
+    if (dump && *dump)
+    {
+        FILE *f = fopen(dump, "w");
+        if (f)
+        {
+            fprintf(f, "frame,compute_ns,present_ns,wall_ns,calls,pixels,logical_cells,dirty\n");
+            for (uint64_t i = head - n; i < head; ++i)
+            {
+                const FrameStat *r = &Telemetry[i % TELEMETRY_FRAMES];
+                fprintf(f, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)i,
+                        (unsigned long long)r->compute, (unsigned long long)r->present,
+                        (unsigned long long)r->wall, (unsigned long long)r->calls,
+                        (unsigned long long)r->pixels, (unsigned long long)r->cells,
+                        (unsigned long long)r->dirty);
+            }
+            fclose(f);
+        }
+        else
+        {
+            perror("sim: SIM_TELEMETRY");
+        }
+    }
+
+    double compute[3], present[3], wall[3];
+    telemetryPercentiles(offsetof(FrameStat, compute), n, compute);
+    telemetryPercentiles(offsetof(FrameStat, present), n, present);
+    telemetryPercentiles(offsetof(FrameStat, wall), n, wall);
+    fprintf(stderr,
+            "sim: %llu frames%s, seed %llu\n"
+            "sim:   compute ms p50/p95/p99 %8.3f %8.3f %8.3f\n"
+            "sim:   present ms p50/p95/p99 %8.3f %8.3f %8.3f\n"
+            "sim:   frame   ms p50/p95/p99 %8.3f %8.3f %8.3f\n"
+            "sim:   %.1f fps, %.3g logical cells/s (compute), %llu pixel calls/frame\n",
+            (unsigned long long)head, Bench ? " (bench)" : "", (unsigned long long)Seed,
+            compute[0], compute[1], compute[2],
+            present[0], present[1], present[2],
+            wall[0], wall[1], wall[2],
+            TotalWall ? head * 1e9 / TotalWall : 0.0,
+            TotalCompute ? TotalCells * 1e9 / TotalCompute : 0.0,
+            (unsigned long long)Telemetry[(head - 1) % TELEMETRY_FRAMES].calls);
+    fprintf(stderr, "sim:   dirty %.1f%% of the window per frame\n",
+            100.0 * TotalDirty / ((double)head * SIM_X_SIZE * SIM_Y_SIZE));
+}
+
+#ifndef SIM_HEADLESS
+/* В текстуру грузятся только прямоугольники rects (SDL_LockTexture по области) */
+static void simUpload(const uint32_t (*frame)[SIM_X_SIZE], const DirtySet *rects)
+{
+    for (int k = 0; k < rects->n; ++k)
+    {
+        const DirtyRect *d = &rects->r[k];
+        SDL_Rect area = { d->x0, d->y0, d->x1 - d->x0, d->y1 - d->y0 };
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(Texture, &area, &pixels, &pitch) != 0)
+            return;
+        for (int y = d->y0; y < d->y1; ++y)
+            memcpy((uint8_t *)pixels + (size_t)(y - d->y0) * pitch, &frame[y][d->x0],
+                   (size_t)area.w * sizeof(uint32_t));
+        SDL_UnlockTexture(Texture);
+    }
+}
+
+/* Копия изменившегося с прошлой записи этого буфера */
+static void copyDirty(uint32_t (*dst)[SIM_X_SIZE], const DirtySet *rects)
+{
+    for (int k = 0; k < rects->n; ++k)
+    {
+        const DirtyRect *d = &rects->r[k];
+        for (int y = d->y0; y < d->y1; ++y)
+            memcpy(&dst[y][d->x0], &Framebuffer[y][d->x0], (size_t)(d->x1 - d->x0) * sizeof(uint32_t));
+    }
+}
+
+static void *presenterMain(void *arg)
+{
+    (void)arg;
     SDL_Init(SDL_INIT_VIDEO);
     SDL_CreateWindowAndRenderer(SIM_X_SIZE, SIM_Y_SIZE, 0, &Window, &Renderer);
+    Texture = SDL_CreateTexture(Renderer, SDL_PIXELFORMAT_ARGB8888,
+                                SDL_TEXTUREACCESS_STREAMING, SIM_X_SIZE, SIM_Y_SIZE);
+    assert(Texture && "Failed to create streaming texture");
+    /* как и у SDL_RenderDrawPoint, альфа пишется в кадр, но не смешивается */
+    SDL_SetTextureBlendMode(Texture, SDL_BLENDMODE_NONE);
     SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 0);
     SDL_RenderClear(Renderer);
-    srand(time(NULL));
-    simPutPixel(0, 0, 0);
-    simFlush();
-}
+    SDL_RenderPresent(Renderer);
+    atomic_store(&PresenterState, PRESENTER_RUNNING);
 
-void simExit()
-{
-    SDL_Event event;
-    while (1)
+    for (;;)
     {
-        if (SDL_PollEvent(&event) && event.type == SDL_QUIT)
-            break;
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT)
+                atomic_store(&QuitRequested, 1);
+        }
+        if (!(atomic_load_explicit(&Ready, memory_order_acquire) & READY_FRESH))
+        {
+            /* последний опубликованный кадр выводим и при остановке */
+            if (atomic_load(&PresenterState) == PRESENTER_STOP)
+                break;
+            SDL_Delay(1);
+            continue;
+        }
+        /* грязные области приходят в том же буфере, что и кадр */
+        Front = atomic_exchange_explicit(&Ready, Front, memory_order_acq_rel) & ~READY_FRESH;
+        simUpload(Present[Front], &PublishDirty[Front]);
+        SDL_RenderCopy(Renderer, Texture, NULL, NULL);
+        SDL_RenderPresent(Renderer);
+        atomic_fetch_add(&Presented, 1);
     }
+
+    SDL_DestroyTexture(Texture);
     SDL_DestroyRenderer(Renderer);
     SDL_DestroyWindow(Window);
     SDL_Quit();
+    return NULL;
+}
+#endif
+
+void simInit()
+{
+    FrameLimit = (long)simOptionInt("sim-frames", 0);
+    Bench = envFlag("sim-bench");
+    const char *seed = simOption("sim-seed");
+    simRandStream(0);
+    simSeed(seed && *seed ? strtoull(seed, NULL, 0) : (unsigned long long)time(NULL));
+    Headless |= envFlag("sim-headless");
+    if (Headless)
+    {
+        const char *video = simOption("sim-video");
+        if (video && *video)
+            videoOpen(video);
+        FrameStart = simNanos();
+        return;
+    }
+#ifndef SIM_HEADLESS
+    /* текстура и буферы вывода поначалу не совпадают с кадром нигде */
+    DirtyRect all = { 0, 0, SIM_X_SIZE, SIM_Y_SIZE };
+    for (int b = 0; b < 3; ++b)
+        dirtyAdd(&SlotDirty[b], all);
+    dirtyAdd(&Unshown, all);
+    if (pthread_create(&Presenter, NULL, presenterMain, NULL) != 0)
+    {
+        perror("sim: presenter thread");
+        exit(1);
+    }
+    while (atomic_load(&PresenterState) == PRESENTER_STARTING)
+        SDL_Delay(1);
+    FrameStart = simNanos();
+#endif
+}
+
+static void snapFinish();
+static void parReport();
+
+void simExit()
+{
+    snapFinish();
+    parReport();
+    telemetryReport();
+    if (Headless)
+    {
+        videoClose();
+        return;
+    }
+#ifndef SIM_HEADLESS
+    while (!Bench && !(FrameLimit && Frames >= FrameLimit) && !atomic_load(&QuitRequested))
+        SDL_Delay(10);
+    atomic_store(&PresenterState, PRESENTER_STOP);
+    pthread_join(Presenter, NULL);
+    fprintf(stderr, "sim:   %llu frames shown by the presenter thread\n",
+            (unsigned long long)atomic_load(&Presented));
+#endif
 }
 
 void simFlush()
 {
-    SDL_PumpEvents();
-    assert(SDL_TRUE != SDL_HasEvent(SDL_QUIT) && "User-requested quit");
-    Uint32 cur_ticks = SDL_GetTicks() - Ticks;
-    if (cur_ticks < FRAME_TICKS)
+    uint64_t start = simNanos(), presentStart = start;
+    Frame.compute = start - FrameStart;
+    Frame.dirty = dirtyArea(&FrameDirty);
+    if (Headless)
     {
-        SDL_Delay(FRAME_TICKS - cur_ticks);
+        if (Video.fd >= 0)
+            videoWrite();
+    }
+    else
+    {
+#ifndef SIM_HEADLESS
+        assert(!atomic_load(&QuitRequested) && "User-requested quit");
+        uint64_t cur_ticks = Frame.compute / 1000000;
+        if (!Bench && cur_ticks < FRAME_TICKS)
+        {
+            SDL_Delay(FRAME_TICKS - cur_ticks);
+        }
+        presentStart = simNanos();
+        for (int b = 0; b < 3; ++b)
+            dirtyMerge(&SlotDirty[b], &FrameDirty);
+        copyDirty(Present[Back], &SlotDirty[Back]);
+        SlotDirty[Back].n = 0;
+        /* Ready без READY_FRESH - прошлый кадр забран и выгрузится целиком со
+           своими областями; иначе его могут заменить, не показав, и его области
+           идут с новым кадром. До первого кадра текстура не совпадает ни в чём */
+        if (Frames && !(atomic_load_explicit(&Ready, memory_order_acquire) & READY_FRESH))
+            Unshown.n = 0;
+        dirtyMerge(&Unshown, &FrameDirty);
+        PublishDirty[Back] = Unshown;
+        Back = atomic_exchange_explicit(&Ready, Back | READY_FRESH, memory_order_acq_rel) & ~READY_FRESH;
+#endif
+    }
+    FrameDirty.n = 0;
+    uint64_t end = simNanos();
+    Frame.present = end - presentStart;
+    Frame.wall = end - FrameStart;
+    FrameStart = end;
+    telemetryPush();
+    if (++Frames == FrameLimit)
+    {
+        simExit();
+        exit(0);
     }
-    SDL_RenderPresent(Renderer);
 }
 
 void simPutPixel(int x, int y, int argb)
 {
     assert(0 <= x && x < SIM_X_SIZE && "Out of range");
     assert(0 <= y && y < SIM_Y_SIZE && "Out of range");
-    Uint8 a = argb >> 24;
-    Uint8 r = (argb >> 16) & 0xFF;
-    Uint8 g = (argb >> 8) & 0xFF;
-    Uint8 b = argb & 0xFF;
-    SDL_SetRenderDrawColor(Renderer, r, g, b, a);
-    SDL_RenderDrawPoint(Renderer, x, y);
-    Ticks = SDL_GetTicks();
+    Framebuffer[y][x] = (uint32_t)argb;
+    markDirty(x, y, 1, 1);
+    ++Frame.calls;
+    ++Frame.pixels;
+}
+
+void simPutSpan(int x, int y, int n, const int *argb)
+{
+    assert(0 <= x && n >= 0 && x + n <= SIM_X_SIZE && "Out of range");
+    assert(0 <= y && y < SIM_Y_SIZE && "Out of range");
+    memcpy(&Framebuffer[y][x], argb, (size_t)n * sizeof(uint32_t));
+    if (n > 0)
+        markDirty(x, y, n, 1);
+    ++Frame.calls;
+    Frame.pixels += n;
+}
+
+void simFillRect(int x, int y, int w, int h, int argb)
+{
+    assert(0 <= x && w >= 0 && x + w <= SIM_X_SIZE && "Out of range");
+    assert(0 <= y && h >= 0 && y + h <= SIM_Y_SIZE && "Out of range");
+    for (int px = 0; px < w; ++px)
+        Framebuffer[y][x + px] = (uint32_t)argb;
+    for (int py = 1; py < h; ++py)
+        memcpy(&Framebuffer[y + py][x], &Framebuffer[y][x], (size_t)w * sizeof(uint32_t));
+    if (w > 0 && h > 0)
+        markDirty(x, y, w, h);
+    ++Frame.calls;
+    Frame.pixels += (uint64_t)w * h;
+}
+
+static void blitDirty(int w, int h, int scale)
+{
+    int cols = w * scale < SIM_X_SIZE ? w * scale : SIM_X_SIZE;
+    int rows = h * scale < SIM_Y_SIZE ? h * scale : SIM_Y_SIZE;
+    if (cols > 0 && rows > 0)
+        markDirty(0, 0, cols, rows);
+}
+
+/*
+ * Вывод сетки w x h (шаг строки stride) с левого верхнего угла: значение ячейки
+ * (обрезанное до 0..255) -> palette[256], каждая ячейка -> квадрат scale x scale.
+ * Всё, что не помещается в окно, отбрасывается.
+ */
+void simBlitCells(const int *cells, int w, int h, int stride, const int *palette, int scale)
+{
+    assert(cells && palette && scale > 0);
+    int cols = w * scale < SIM_X_SIZE ? w * scale : SIM_X_SIZE;
+    for (int gy = 0; gy < h && gy * scale < SIM_Y_SIZE; ++gy)
+    {
+        const int *src = cells + (size_t)gy * stride;
+        uint32_t *row = Framebuffer[gy * scale];
+        for (int gx = 0, x = 0; x < cols; ++gx)
+        {
+            int T = src[gx];
+            if (T < 0) T = 0;
+            if (T > 255) T = 255;
+            uint32_t color = (uint32_t)palette[T];
+            for (int px = 0; px < scale && x < cols; ++px)
+                row[x++] = color;
+        }
+        for (int py = 1; py < scale && gy * scale + py < SIM_Y_SIZE; ++py)
+            memcpy(Framebuffer[gy * scale + py], row, (size_t)cols * sizeof(uint32_t));
+        Frame.pixels += (uint64_t)cols * (gy * scale + scale <= SIM_Y_SIZE ? scale : SIM_Y_SIZE - gy * scale);
+    }
+    blitDirty(w, h, scale);
+    ++Frame.calls;
+}
+
+/* То же для 8-битных ячеек (значения уже 0..255, обрезка не нужна) */
+void simBlitCells8(const unsigned char *cells, int w, int h, int stride, const int *palette, int scale)
+{
+    assert(cells && palette && scale > 0);
+    int cols = w * scale < SIM_X_SIZE ? w * scale : SIM_X_SIZE;
+    for (int gy = 0; gy < h && gy * scale < SIM_Y_SIZE; ++gy)
+    {
+        const unsigned char *src = cells + (size_t)gy * stride;
+        uint32_t *row = Framebuffer[gy * scale];
+        for (int gx = 0, x = 0; x < cols; ++gx)
+        {
+            uint32_t color = (uint32_t)palette[src[gx]];
+            for (int px = 0; px < scale && x < cols; ++px)
+                row[x++] = color;
+        }
+        for (int py = 1; py < scale && gy * scale + py < SIM_Y_SIZE; ++py)
+            memcpy(Framebuffer[gy * scale + py], row, (size_t)cols * sizeof(uint32_t));
+        Frame.pixels += (uint64_t)cols * (gy * scale + scale <= SIM_Y_SIZE ? scale : SIM_Y_SIZE - gy * scale);
+    }
+    blitDirty(w, h, scale);
+    ++Frame.calls;
+}
+
+int *simFramebuffer()
+{
+    return (int *)&Framebuffer[0][0];
+}
+
+void simMarkDirty(int x, int y, int w, int h)
+{
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > SIM_X_SIZE) w = SIM_X_SIZE - x;
+    if (y + h > SIM_Y_SIZE) h = SIM_Y_SIZE - y;
+    if (w > 0 && h > 0)
+        markDirty(x, y, w, h);
+}
+
+void simAddCells(long long n)
+{
+    Frame.cells += (uint64_t)n;
+}
+
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t randNext(RandState *r)
+{
+    uint64_t *s = r->s;
+    uint64_t result = rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
+/* Эквивалент 2^128 вызовов randNext */
+static void randJump(RandState *r)
+{
+    static const uint64_t JUMP[4] = { 0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull,
+                                      0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull };
+    uint64_t t[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; ++i)
+        for (int b = 0; b < 64; ++b)
+        {
+            if (JUMP[i] & (1ull << b))
+                for (int k = 0; k < 4; ++k)
+                    t[k] ^= r->s[k];
+            randNext(r);
+        }
+    memcpy(r->s, t, sizeof(t));
+}
+
+static RandState *randState()
+{
+    RandState *r = &Rand;
+    uint64_t gen = atomic_load_explicit(&SeedGen, memory_order_acquire);
+    if (r->gen == gen)
+        return r;
+    if (!r->hasStream)
+    {
+        r->stream = atomic_fetch_add(&NextStream, 1);
+        r->hasStream = 1;
+    }
+    uint64_t x = Seed;
+    for (int k = 0; k < 4; ++k)
+        r->s[k] = splitmix64(&x);
+    for (unsigned k = 0; k < r->stream; ++k)
+        randJump(r);
+    r->gen = gen;
+    return r;
+}
+
+void simSeed(unsigned long long seed)
+{
+    Seed = seed;
+    atomic_fetch_add_explicit(&SeedGen, 1, memory_order_release);
+}
+
+void simRandStream(unsigned stream)
+{
+    Rand.stream = stream;
+    Rand.hasStream = 1;
+    Rand.gen = 0;
 }
 
 int simRand()
 {
-    return rand();
-}
\ No newline at end of file
+    return (int)(randNext(randState()) >> 33);
+}
+
+void simRandFill(int *out, int n)
+{
+    RandState *r = randState();
+    for (int i = 0; i < n; ++i)
+        out[i] = (int)(randNext(r) >> 33);
+}
+/*
+ * Снимок: заголовок в первой странице, с начала следующей - поле (h строк по
+ * stride клеток, та же раскладка, что в памяти, поэтому отображение файла
+ * годится под буфер сетки как есть), затем 6 массивов источников.
+ * simSnapshotSave копирует состояние в буфер и сразу возвращается; файл пишет
+ * отдельный поток: path.tmp, fsync, rename - на диске всегда целый снимок.
+ */
+#define SNAP_MAGIC 0x50414E5354414548ull /* "HEATSNAP" */
+#define SNAP_VERSION 1
+#define SNAP_PAGE 4096
+
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t w, h, stride, elem, sources;
+    int64_t frame;
+    uint64_t rand[4];
+    uint64_t fieldOffset, srcOffset, size;
+} SnapHeader;
+
+static struct
+{
+    pthread_t writer;
+    int hasWriter;
+    atomic_int busy;
+    char *image;
+    size_t cap, size;
+    char path[4096];
+    unsigned long long written, skipped;
+    uint64_t writeNs;
+} Snap;
+
+static void *snapWriter(void *arg)
+{
+    (void)arg;
+    uint64_t t0 = simNanos();
+    char tmp[sizeof(Snap.path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", Snap.path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0;
+    for (size_t done = 0; ok && done < Snap.size; )
+    {
+        ssize_t n = write(fd, Snap.image + done, Snap.size - done);
+        ok = n > 0;
+        done += ok ? (size_t)n : 0;
+    }
+    ok = ok && fsync(fd) == 0;
+    if (fd >= 0)
+        ok = close(fd) == 0 && ok;
+    if (ok && rename(tmp, Snap.path) == 0)
+        ++Snap.written;
+    else
+        perror("sim: snapshot write");
+    Snap.writeNs += simNanos() - t0;
+    atomic_store(&Snap.busy, 0);
+    return NULL;
+}
+
+static void snapFinish()
+{
+    if (!Snap.hasWriter)
+        return;
+    pthread_join(Snap.writer, NULL);
+    Snap.hasWriter = 0;
+    fprintf(stderr, "sim: %llu snapshots written (%.1f ms each), %llu skipped while writing\n",
+            Snap.written, Snap.written ? Snap.writeNs / 1e6 / Snap.written : 0.0, Snap.skipped);
+}
+
+int simSnapshotSave(const char *path, const SimSnapshot *s)
+{
+    if (atomic_load(&Snap.busy))
+    {
+        ++Snap.skipped;
+        return -1;
+    }
+    if (Snap.hasWriter)
+        pthread_join(Snap.writer, NULL);
+
+    const size_t field = (size_t)s->stride * s->h * s->elem;
+    const size_t srcOffset = SNAP_PAGE + (field + SNAP_PAGE - 1) / SNAP_PAGE * SNAP_PAGE;
+    const size_t size = srcOffset + 6 * (size_t)s->sources * sizeof(int);
+    if (size > Snap.cap)
+    {
+        free(Snap.image);
+        Snap.image = calloc(1, size);
+        Snap.cap = size;
+        if (!Snap.image)
+        {
+            perror("sim: snapshot");
+            exit(1);
+        }
+    }
+    SnapHeader hdr = { SNAP_MAGIC, SNAP_VERSION, s->w, s->h, s->stride, s->elem, s->sources,
+                       s->frame, { 0 }, SNAP_PAGE, srcOffset, size };
+    memcpy(hdr.rand, randState()->s, sizeof(hdr.rand));
+    memcpy(Snap.image, &hdr, sizeof(hdr));
+    memcpy(Snap.image + SNAP_PAGE, s->field, field);
+    for (int k = 0; k < 6; ++k)
+        memcpy(Snap.image + srcOffset + (size_t)k * s->sources * sizeof(int), s->src[k],
+               (size_t)s->sources * sizeof(int));
+    Snap.size = size;
+    snprintf(Snap.path, sizeof(Snap.path), "%s", path);
+
+    atomic_store(&Snap.busy, 1);
+    Snap.hasWriter = pthread_create(&Snap.writer, NULL, snapWriter, NULL) == 0;
+    if (!Snap.hasWriter)
+    {
+        perror("sim: snapshot thread");
+        atomic_store(&Snap.busy, 0);
+        return -1;
+    }
+    return 0;
+}
+
+void simSnapshotLoad(const char *path, SimSnapshot *s)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    SnapHeader hdr;
+    char *map = (size_t)sb.st_size >= sizeof(hdr)
+                    ? mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+                    : MAP_FAILED;
+    close(fd);
+    if (map != MAP_FAILED)
+        memcpy(&hdr, map, sizeof(hdr));
+    if (map == MAP_FAILED || hdr.magic != SNAP_MAGIC || hdr.version != SNAP_VERSION ||
+        hdr.size != (uint64_t)sb.st_size || hdr.w < 3 || hdr.h < 3 || hdr.stride < hdr.w ||
+        (hdr.elem != 1 && hdr.elem != (int)sizeof(int)) || hdr.sources < 0 ||
+        hdr.fieldOffset + (uint64_t)hdr.stride * hdr.h * hdr.elem > hdr.srcOffset ||
+        hdr.srcOffset + 6 * (uint64_t)hdr.sources * sizeof(int) > hdr.size)
+    {
+        fprintf(stderr, "sim: %s is not a snapshot\n", path);
+        exit(1);
+    }
+    /* отображение не снимается: поле и источники остаются в нём (копия при записи) */
+    s->w = hdr.w;
+    s->h = hdr.h;
+    s->stride = hdr.stride;
+    s->elem = hdr.elem;
+    s->sources = hdr.sources;
+    s->frame = hdr.frame;
+    s->field = map + hdr.fieldOffset;
+    for (int k = 0; k < 6; ++k)
+        s->src[k] = (int *)(map + hdr.srcOffset) + (size_t)k * hdr.sources;
+    RandState *r = randState();
+    memcpy(r->s, hdr.rand, sizeof(r->s));
+}
+
+/*
+ * simParallelFor: постоянный пул из SIM_THREADS потоков (0 - все ядра, по
+ * умолчанию 1 - без потоков), создаётся при первом вызове. Между вызовами
+ * потоки спят на условной переменной; [begin, end) раздаётся кусками по grain
+ * через атомарный счётчик, вызывающий поток берёт куски наравне с остальными
+ * и возвращается, когда готовы все. Вызовы не вкладываются и идут из одного потока.
+ */
+#define PAR_SPINS_BEFORE_YIELD 256
+
+static struct
+{
+    int threads;                /* 0 - пул ещё не создан */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint64_t generation;
+    void (*fn)(int, int);
+    int end, grain;
+    atomic_int next;
+    atomic_int running;         /* рабочих, ещё не закончивших текущий вызов */
+    unsigned long long calls, serial;
+    uint64_t wallNs;
+} Par = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static void parChunks()
+{
+    for (;;)
+    {
+        int b = atomic_fetch_add_explicit(&Par.next, Par.grain, memory_order_relaxed);
+        if (b >= Par.end)
+            return;
+        Par.fn(b, Par.end - b > Par.grain ? b + Par.grain : Par.end);
+    }
+}
+
+static void *parWorker(void *arg)
+{
+    (void)arg;
+    uint64_t seen = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&Par.lock);
+        while (Par.generation == seen)
+            pthread_cond_wait(&Par.wake, &Par.lock);
+        seen = Par.generation;
+        pthread_mutex_unlock(&Par.lock);
+        parChunks();
+        atomic_fetch_sub_explicit(&Par.running, 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void parStart()
+{
+    long n = simOptionInt("sim-threads", 1);
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    Par.threads = n > 0 ? (int)n : 1;
+    for (int t = 1; t < Par.threads; ++t)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, parWorker, NULL) != 0)
+        {
+            perror("sim: parallel for thread");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+}
+
+int simThreads()
+{
+    if (!Par.threads)
+        parStart();
+    return Par.threads;
+}
+
+void simParallelFor(void (*fn)(int begin, int end), int begin, int end, int grain)
+{
+    if (end <= begin)
+        return;
+    if (!Par.threads)
+        parStart();
+    if (grain < 1)
+        grain = 1;
+    if (Par.threads < 2 || end - begin <= grain)
+    {
+        ++Par.serial;
+        fn(begin, end);
+        return;
+    }
+    uint64_t t0 = simNanos();
+    pthread_mutex_lock(&Par.lock);
+    Par.fn = fn;
+    Par.end = end;
+    Par.grain = grain;
+    atomic_store_explicit(&Par.next, begin, memory_order_relaxed);
+    atomic_store_explicit(&Par.running, Par.threads - 1, memory_order_relaxed);
+    ++Par.generation;
+    pthread_cond_broadcast(&Par.wake);
+    pthread_mutex_unlock(&Par.lock);
+    parChunks();
+    for (int spin = 0; atomic_load_explicit(&Par.running, memory_order_acquire) > 0; ++spin)
+    {
+        if (spin >= PAR_SPINS_BEFORE_YIELD)
+            sched_yield();
+    }
+    ++Par.calls;
+    Par.wallNs += simNanos() - t0;
+}
+
+static void parReport()
+{
+    if (Par.threads < 2)
+        return;
+    fprintf(stderr, "sim: parallel for on %d threads: %llu calls (%.1f us each), %llu run serially\n",
+            Par.threads, Par.calls, Par.calls ? Par.wallNs / 1e3 / Par.calls : 0.0, Par.serial);
+}
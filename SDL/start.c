@@ -1,7 +1,8 @@
 #include "sim.h"
 
-int main(void)
+int main(int argc, char **argv)
 {
+    simArgs(argc, argv);
     simInit();
     app();
     simExit();